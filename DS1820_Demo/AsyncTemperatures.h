@@ -1,4 +1,3 @@
-
 #pragma once
 
 // An implementation of the 1-wire and Dallas 1820 temperature sensor, all mangled together.
@@ -25,9 +24,16 @@
 // that does not use long busy waits so your MCU can be doing its usual
 // stuff in the meantime.
 
+#ifdef ARDUINO
 #include <util/delay.h>   // For _delay_us() which is more accurate than delayMicroseconds
+#include <avr/pgmspace.h> // For the canned programs, which live in flash
+#else
+#include "SimulatedBus.h" // Host build: simulated ports, TIMER2 and virtual time.
+#endif
+#include "OneWireBusPorts.h"   // PortB and friends: see "three electrical things" below.
 
-const int stackSize = 24;
+const int stackSize = 24;   // The simulator's high tide is 20 (an alarm read queued between two cycles of
+                            // sampleContinuouslyAsync()), and 4 more to spare.
 
 // Various debugging and diagnostic stuff ---------------
 
@@ -96,35 +102,33 @@ void toggleDebugLine()
 // do not talk). Loose protocol timings are acceptable.
 
 // This code is very specific for my little sensors - some from the cheap Chinese
-// 37-piece sensor kit.  So I have not yet catered for the more exotic features like
-// CRC checks, parasitic power mode, different device resolutions, etc.
-// That is left as a homework exercise for someone else :-)
+// 37-piece sensor kit.  So I have not catered for all the more exotic features.
+// (CRC checks are done now, on the fly as the bits arrive, you can set the resolution,
+// see writeAllScratchpadsAsync(), and two-wire, parasitically powered probes work too,
+// see readPowerSupplyAsync().)  The rest is left as a homework exercise for someone else :-)
 
 // Wiring:
+// The reader is a template: AsyncTemperatureReader<PortB, 0b00010000> drives bit 4 of PORTB.
 // On a UNO, PORTB, bit 4 maps to pin 12.  Connect your 1-wire bus there.
 // On a Mega2560, PORTB bit 4 maps to pin 10.
 // Connect your 1-wire bus there. And if you're going to also use the
 // Dallas lib in the main program on a Mega, change the pin number.
+// Any other port and bit will do: on a UNO, <PortD, 0b00000100> is pin 2, for example.
 
 
-// There are only three "electrical" things the master can do on a 1-wire bus:
-
-const byte busPinMask = 0b00010000;
-inline void pullBusLow()
-{
-  DDRB |= busPinMask;     // Set direction for OUTPUT
-  PORTB &= ~busPinMask;   // Turn off the port bit to write a LOW
-}
-
-inline void releaseBus()
-{
-  DDRB &= ~busPinMask;   // Set direction for INPUT, i.e. high impedance
-}
-
-inline byte sampleBus()
-{
-  return (PINB & busPinMask) != 0;    // Read value of 1-wire pin.
-}
+// There are only three "electrical" things the master can do on a 1-wire bus.
+// They are the whole of the bus backend.  On the Arduino they are direct port manipulation.
+// In a host build (ARDUINO not defined) SimulatedBus.h supplies the port registers
+// instead, backed by an open-drain wire model in virtual time, so everything from here
+// down runs unchanged on Linux.
+//
+// Each port is a little type that knows its three registers.  The port and the pin mask
+// are template parameters, so with the mask a compile-time constant each of these
+// compiles down to a single sbi / cbi / sbis instruction, just as the old hard-wired
+// PORTB code did.  They're declared in OneWireBusPorts.h, which SensorDiscovery.h uses too.
+// Well, there's a fourth thing, for parasitically powered devices: drive the line high,
+// hard, so they have the current for a conversion or an EEPROM write.  The pull-up
+// resistor can't supply that.
 
 
 // OneWire commands, only some are used here
@@ -144,7 +148,25 @@ inline byte sampleBus()
 const byte StillBusy = 0x01;         // Wait for this bit to become 0 before interrogating the other status bits.
 const byte NoDeviceOnBus = 0x02;     // bit set indicates no device responded on the bus after RESET.
 const byte DevicesAreBusy = 0x04;    // bit set means we're still waiting for sensors to complete their conversions.
-const byte CRCError = 0x08;          // Future use.
+const byte CRCError = 0x08;          // bit set means the scratchpad or ROM ID we read failed its CRC check.
+const byte OtherBusesBusy = 0x10;    // In calibrateTimingsAsync()'s ticket only: other readers kept the timer busy, so the timings were left alone.
+const byte NoResult = 0x80;          // From getTicketStatus() only: the request was cancelled, or is too long ago to remember.
+
+// Every request gets a ticket, so you can ask how it went later.  Never this one:
+// it means the queue was full and nothing was queued.
+const byte NoTicket = 0;
+
+// One finished scratchpad read, as the interpreter hands it to the main loop through the
+// ring buffer (see setReadingRing()).
+// The ISR only copies the device's own count in; the reader's getRaw(reading) and
+// getTempC(reading) do the rest, with whatever floating point that takes, in the main loop.
+struct TemperatureReading {
+  byte device;          // Where the device is in the list being read (0 for single reads).
+  byte status;          // NoDeviceOnBus and/or CRCError if the read failed (after any retries), else 0.
+  byte family;          // The device's family code, which says what count is in.
+  int16_t count;        // The temperature as the device counts it (see countOf()).  Only good if status is 0.
+  unsigned long at;     // millis() when the read finished.
+};
 
 
 // The opcodes for our interpreter...
@@ -160,27 +182,450 @@ const byte SendRemainingBits = 8;   // Two opands (n, b). n is bitcount still to
 const byte SendRemainingIDBytes = 9;// One opand n. Index of next ID byte to send. It expands into SendRemainingBits for each ID byte.
 const byte ClearBusyStatus = 10;    // Typically scheduled as the last instruction after the final delay before the interpreter becomes idle.
 const byte TestTimings = 11;        // Two-byte opand is number of times to still repeat our test timing sequence
-const byte ReadScratchPad = 12;     // Initiates reading of whole scratchpad.  No opand
+const byte ReadScratchPad = 12;     // Two opands (multiDrop, n). Reads the first n bits of the scratchpad, then resets the bus.
 const byte StartIDSend = 13;        // After Reset we have to address a specific device by ID in order to read its scratchpad
+const byte ReadNextScratchPad = 14; // One opand: index into deviceList of the next device whose scratchpad we read.
+const byte CheckCRC = 15;           // Scheduled after a ReadRemainingBits that read a whole CRC-protected block. Sets CRCError if it failed.
+const byte RetryIfFailed = 16;      // Last step of ReadScratchPad. If that read failed and we have retries left, read again.
+const byte SendRemainingLaneBits = 17; // Two opands (n, i). Multi-lane SendRemainingIDBytes: bits still to send of byte i of every lane's device ID.
+const byte SearchNextDevice = 18;   // One opand: true on the first pass. One more walk down the ROM search tree, to the next device.
+const byte SearchBit = 19;          // Two opands (phase, depth). Reads the ID bit and its complement at depth, picks a branch, sends it.
+const byte SearchFoundDevice = 20;  // End of a search pass: if the ID's CRC checks out, keep it in the table.
+const byte ReadFoundScratchPads = 21; // Reads the scratchpad of every device the search put in its table.
+const byte WaitForDevices = 22;     // Two opands (lo, hi): ms the devices may still need.  Waits them out, or hands over to WaitForBusRelease if they hold the bus.
+const byte SendWriteBytes = 23;     // One opand: index of the next byte of writeBuf to send after WRITESCRATCH.
+const byte CopyScratchPad = 24;     // Saves TH, TL and config to EEPROM on the device(s) we just wrote to, and waits for it.
+const byte PollConversion = 25;     // After STARTCONVO: a read slot every pollInterval tics, until the devices answer 1 (done).  Always followed by LearnConversion or RecordConversion.
+const byte ConversionStarted = 26;  // One opand: true if deviceList is what matters.  Sleeps until the conversion should nearly be done, then polls.
+const byte Sleep = 27;              // Two opands (lo, hi): ms still to sleep.  Up to maxSleepMillis per timeslice.
+const byte LearnConversion = 28;    // After PollConversion: folds the conversion time into what we expect of the bus.
+const byte StartConversionClock = 29; // Notes the time, right after STARTCONVO.
+const byte RecordConversion = 30;   // After PollConversion: folds the conversion time into the profile of device deviceIndex.
+const byte ProfileNextDevice = 31;  // One opand: index into deviceList of the next device to time a conversion of, on its own.
+const byte StrongPullup = 32;       // Two opands (lo, hi): ms to power parasitic devices for, with the line driven high.
+const byte EndStrongPullup = 33;    // Lets go of the line after StrongPullup, and says the devices are done.
+const byte ReadPowerSupply = 34;    // After READPOWERSUPPLY: a read slot, which parasitic devices answer with 0.
+const byte NextSample = 35;         // Continuous sampling: sleeps out the rest of the period, then converts and reads the list, and comes back.
+const byte Calibrate = 36;          // One opand: yields still to time.  Times yields of Micros55 against micros(), then redoes slotTics.
+const byte RunProgram = 37;         // Two opands (program, pc).  Pushes the step at pc of a canned program in flash, and comes back for the next one.
+const byte WaitForConversion = 38;  // One opand: true if deviceList is what matters.  The wait after STARTCONVO: see pushWaitForConversion().
+const byte ReadScratchPadBits = 39; // Reads the readNumBits bits ReadScratchPad was asked for, and checks the CRC if that's all 72.
+
+// Canned programs.  Most transactions are the same every time: reset, skip ROM or select,
+// a command, then read or wait.  Pushing all that, back to front, every time we start one
+// costs a dozen push()es and a stack deep enough to hold the lot.  So these live in flash,
+// front to back, and RunProgram walks them with a program counter: only (program, pc)
+// sits on the stack, plus whatever the step it just pushed needs.
+// A step is a count, then that many bytes to push, in the order push() would get them:
+// opands first, opcode last.  A count of 0 ends the program.
+#define StepOp(op)        1, (op)
+#define StepOp1(a, op)    2, (a), (op)
+#define StepSendByte(b)   3, (b), 8, SendRemainingBits
+#define StepReadBits(n)   3, (n), 0, ReadRemainingBits
+#define StepEnd           0
+
+const byte ConvertAllProgram = 0;
+const byte ConvertListProgram = 1;       // Converts, then reads deviceList.
+const byte ReadSelectedProgram = 2;      // ReadScratchPad's: to the device at deviceAddr, ...
+const byte ReadSkipRomProgram = 3;       // ... or to the only device on the bus.
+const byte ReadRomProgram = 4;
+const byte PowerSupplyProgram = 5;
+const byte ConvertAlarmedProgram = 6;    // Converts, then searches for alarms and reads them.
+const byte ProfileDeviceProgram = 7;     // Times the conversion of the device at deviceAddr.
+
+const byte convertAllSteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(SKIPROMWILDCARD), StepSendByte(STARTCONVO), StepOp1(false, WaitForConversion),
+  StepEnd
+};
+const byte convertListSteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(SKIPROMWILDCARD), StepSendByte(STARTCONVO), StepOp1(true, WaitForConversion),
+  StepOp1(0, ReadNextScratchPad),
+  StepEnd
+};
+const byte readSelectedSteps[] PROGMEM = {
+  StepOp(Reset), StepOp(StartIDSend), StepSendByte(READSCRATCH), StepOp(ReadScratchPadBits),
+  StepOp(Reset),                         // Also aborts the device's transmission if we stop reading early.
+  StepOp(RetryIfFailed),
+  StepEnd
+};
+const byte readSkipRomSteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(SKIPROMWILDCARD), StepSendByte(READSCRATCH), StepOp(ReadScratchPadBits),
+  StepOp(Reset),
+  StepOp(RetryIfFailed),
+  StepEnd
+};
+const byte readRomSteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(READROM), StepReadBits(64),
+  StepOp(CheckCRC),                      // The last of the 8 bytes is the CRC of the other 7
+  StepEnd
+};
+const byte powerSupplySteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(SKIPROMWILDCARD), StepSendByte(READPOWERSUPPLY), StepOp(ReadPowerSupply),
+  StepEnd
+};
+const byte convertAlarmedSteps[] PROGMEM = {
+  StepOp(Reset), StepSendByte(SKIPROMWILDCARD), StepSendByte(STARTCONVO), StepOp1(false, WaitForConversion),
+  StepOp1(true, SearchNextDevice),       // true: the first pass
+  StepOp(ReadFoundScratchPads),
+  StepEnd
+};
+const byte profileDeviceSteps[] PROGMEM = {
+  StepOp(Reset), StepOp(StartIDSend), StepSendByte(STARTCONVO),
+  StepOp(StartConversionClock), StepOp(PollConversion), StepOp(RecordConversion),
+  StepEnd
+};
+const byte noSteps[] PROGMEM = {
+  StepEnd
+};
+
+inline const byte *programSteps(byte program)
+{
+  switch (program) {
+    case ConvertAllProgram: return convertAllSteps;
+    case ConvertListProgram: return convertListSteps;
+    case ReadSelectedProgram: return readSelectedSteps;
+    case ReadSkipRomProgram: return readSkipRomSteps;
+    case ReadRomProgram: return readRomSteps;
+    case PowerSupplyProgram: return powerSupplySteps;
+    case ConvertAlarmedProgram: return convertAlarmedSteps;
+    case ProfileDeviceProgram: return profileDeviceSteps;
+  }
+  return noSteps;      // Not a program: it ends before it starts, rather than running some other one.
+}
 
 // http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
 // The protocol mandates certain delays (desired). I map those into
-// TIMER2 counter values (it depends on my prescaler resolution).
-// There are some inaccuracies and overheads because the ISR and the
-// code here takes time to execute...  So measured these on the
-// oscilloscope as best I could.
-// We use /64 clock prescaler.  If you change that you will
-// need to adjust these numbers.    Values must be <= 255.
-
-//  DelayDesired     = OCR2A tics   //  Observed delay when measured
-const byte Micros55  = 8;    //        todo
-const byte Micros60  = 10;   //
-const byte Micros64  = 11;   //
-const byte Micros70  = 12;   //
-const byte Micros410 = 96;   //
-const byte Micros480 = 110;  //
-
-class AsyncTemperatureReader
+// TIMER2 counter values, which depend on the clock and the prescaler.
+// I used to work them out by hand for a 16MHz UNO at /64, and tweak them on the
+// oscilloscope, which was no good to anybody on an 8MHz board.  Now the compiler
+// works them out from F_CPU.
+//
+// What the scope did teach me is that the ISR takes a while to get going: the prologue,
+// and the dispatch in the ISR and in doTimeslice().  About 24us on a UNO.  The scheduler
+// takes care of that now: a yield counts from when its timeslice started, and the
+// scheduler asks for the interrupt early by however long the last one took to get in.
+// So a yield is just the time between two timeslices, each with the same bit of the
+// bus protocol at the same place in it.
+
+// TIMER2 runs from the finest prescaler that still gets the longest slot timing (480us)
+// into its 8-bit compare register: the finer the tic, the closer each delay comes to what
+// we asked for.  16MHz gets /32, 2us tics.
+constexpr unsigned int timer2Divisor(byte cs)   // The prescaler for TCCR2B clock select cs (1 to 7).
+{
+  return cs == 1 ? 1 : cs == 2 ? 8 : cs == 3 ? 32 : cs == 4 ? 64 : cs == 5 ? 128 : cs == 6 ? 256 : 1024;
+}
+
+// The tics to yield for so that at least us microseconds go by, if a yield costs overheadCycles
+// on top of its tics (calibrateTimingsAsync() finds out).  Rounded up, plus one: the scheduler's
+// clock is TCNT2, rounded down, so a timeslice can start up to a tic before its time.
+constexpr long ticsFor(unsigned long us, unsigned int divisor, long overheadCycles = 0)
+{
+  return ((long) (us * (F_CPU / 1000UL) / 1000UL) - overheadCycles + divisor - 1) / (long) divisor + 1;
+}
+
+constexpr byte finestClockSelect(byte cs = 1)
+{
+  return cs == 7 || ticsFor(480, timer2Divisor(cs)) <= 255 ? cs : finestClockSelect(cs + 1);
+}
+
+const byte ticClockSelect = finestClockSelect();         // Goes straight into TCCR2B: CS22..CS20.
+const unsigned int ticDivisor = timer2Divisor(ticClockSelect);
+
+constexpr bool fitsTimer2(long tics)
+{
+  return tics >= 1 && tics <= 255;
+}
+
+//  DelayDesired     = OCR2A tics
+const byte Micros55  = ticsFor(55, ticDivisor);
+const byte Micros64  = ticsFor(64, ticDivisor);
+const byte Micros70  = ticsFor(70, ticDivisor);
+const byte Micros480 = ticsFor(480, ticDivisor);
+const unsigned int Micros1000 = ticsFor(1000, ticDivisor);  // Only for long waits, where a few us either way hardly matter.
+const byte Micros10 = ticsFor(10, ticDivisor);   // BusRelease's recovery time: see edgeTics.
+
+static_assert(fitsTimer2(ticsFor(55, ticDivisor)), "Micros55 doesn't fit in OCR2A");
+static_assert(fitsTimer2(ticsFor(64, ticDivisor)), "Micros64 doesn't fit in OCR2A");
+static_assert(fitsTimer2(ticsFor(70, ticDivisor)), "Micros70 doesn't fit in OCR2A");
+static_assert(fitsTimer2(ticsFor(480, ticDivisor)), "F_CPU is too fast for TIMER2 to time a 480us reset pulse");
+
+// Each reader keeps its own copy of these, in slotTics[], which calibrateTimingsAsync() can
+// redo from how long its yields really take.  These are the indexes into it.
+// Only the waits that may safely come out long are yields: the slot as a whole, and the
+// reset's low and high halves.  The low half of a write-0 slot, and the wait from letting go
+// of a reset to looking for the presence pulse, have a deadline at the far end as well (at
+// 120us a write-0 turns into a reset, and a presence pulse can be over 75us after the
+// release).  With several buses on the timer, a timeslice can start late by as long as the
+// others take, so those two are busy-waited inside the one timeslice instead.
+const byte Slot55 = 0;
+const byte Slot64 = 1;
+const byte Slot70 = 2;
+const byte Slot480 = 3;
+const byte numSlotTimings = 4;
+const unsigned int slotMicros[numSlotTimings] = { 55, 64, 70, 480 };
+const byte defaultSlotTics[numSlotTimings] = { Micros55, Micros64, Micros70, Micros480 };
+
+// None of those timings has any slack over the 1-wire minimums, so calibration may only
+// take off what it really saw a yield cost, and never more than this.  A measurement that
+// says more is somebody else's interrupt getting in the way, not our overhead.
+const byte maxCorrectionMicros = 8;
+
+// Longer sleeps are in ms, and handed to busScheduler as a 16-bit holdoff.
+const unsigned int TicsPerMilli = F_CPU / 1000UL / ticDivisor;
+const byte maxSleepMillis = 30000U / TicsPerMilli;   // The scheduler's clock only looks 32767 tics ahead.
+static_assert(30000U / TicsPerMilli >= 1 && 30000U / TicsPerMilli <= 255, "No sensible sleep chunk at this F_CPU");
+
+// For long waits the scheduler coasts on the coarsest prescaler that keeps a whole lap of
+// TIMER2 (255 of its tics) inside its clock's reach.
+constexpr byte coarsestClockSelect(byte cs = 7)
+{
+  return cs == ticClockSelect || timer2Divisor(cs) / ticDivisor <= 128 ? cs : coarsestClockSelect(cs - 1);
+}
+
+const byte coastClockSelect = coarsestClockSelect();
+const unsigned int coastFactor = timer2Divisor(coastClockSelect) / ticDivisor;   // Our tics per coasting tic.
+
+// How long a DS18B20 may take to convert, at each resolution (datasheet max), in ms.
+// Family 0x10 parts have no choice: they always take up to 750ms.
+inline unsigned int conversionMillis(byte resolutionBits)
+{
+  return 750 >> (12 - resolutionBits);   // 9 bits: 93.75ms, rounded down, ...
+}
+
+// A DS18B20 only has resolutions of 9 to 12 bits.  Anything else we're asked for is
+// pulled into that range before it gets near the config register or conversionMillis().
+inline byte validResolution(byte resolutionBits)
+{
+  if (resolutionBits < 9) return 9;
+  if (resolutionBits > 12) return 12;
+  return resolutionBits;
+}
+
+// One timer, several buses.
+// Anything that wants timeslices from TIMER2 is a TimeslicedTask.  Each AsyncTemperatureReader
+// is one, on its own pin, and registers itself with busScheduler in begin().
+// The scheduler keeps its own clock in TIMER2 tics, and for each task the tic at which
+// its next timeslice is due.  It always sets the timer for the earliest of those
+// deadlines, and when the timer fires, every task that is due gets its timeslice.
+// So four readers on four short cables run their transactions side by side, and 40 sensors
+// split across them scan in about the time 10 take on one long cable.
+// TIMER2 never stops or starts again from 0 while there's work: it just counts, and laps,
+// and each interrupt moves OCR2A on to the next deadline.  A deadline is the holdoff after
+// the tic the task's last timeslice *started*, however long that timeslice took, or
+// however long somebody else's before it did.  And the interrupt is asked for early, by as
+// long as the last one took to get into doTimeslices(), so the timeslice starts on time.
+// So the time from one bus edge to the next is the holdoff, and nothing adds up over a
+// 72-bit read.  What's left is a bit of jitter: when two buses come due on the same tic,
+// the second waits while the first one's timeslice runs (15us or so).  That only makes its
+// wait longer, never shorter.  1-wire is forgiving about long gaps between slots, but not
+// about a write-0's low (at 120us it's a reset) or the wait for a presence pulse, so those
+// two are never left to the timer: they're busy-waited inside the one timeslice.
+// A holdoff can be long (sleeping through most of a conversion, say), but an 8-bit
+// counter at 2us a tic laps every 0.5ms.  So when nobody is due for a while, the
+// scheduler "coasts": it runs TIMER2 from the /1024 prescaler, coastFactor of our tics to
+// each of its, and wakes up every 16ms at most instead of every 0.5ms.  It wakes a little
+// early, and does the last stretch on our own tics again.  A task that gets new work meanwhile
+// calls wake(), so it doesn't have to sleep out its holdoff first.
+// And a task with nothing at all to do says so (NothingToDo), and gets no more timeslices
+// until it's woken.  Once every task is like that, the scheduler turns the compare
+// interrupt off and stops TIMER2 altogether: an idle bus costs no interrupts at all, and
+// whatever else the MCU is doing isn't jittered by them.  wake() starts it all up again.
+
+const unsigned int NothingToDo = 0xFFFF;     // A holdoff no task would ask for: "don't call me, I'll call you".
+const unsigned int longestHoldoff = 32767;   // Deadlines are compared as signed 16-bit differences: any further off looks overdue.
+
+class TimeslicedTask
+{
+  public:
+    virtual unsigned int doTimeslice() = 0;   // Pre: interrupts disabled.  Returns its holdoff in TIMER2 tics, up to longestHoldoff, or NothingToDo.
+};
+
+const byte maxTasks = 6;              // How many buses the one timer can serve.
+const byte longestInterval = 192;     // Tics to the next interrupt, at most: room for the ISR to get in before TCNT2 laps.
+const byte maxSlotsPerSlice = 4;      // Bit slots in one timeslice, at most: 4 x 70us, and the ISR around them, is about half a lap of TCNT2.
+const unsigned int longestStayMicros = 100;   // How long the ISR may go on handing out overdue timeslices: the main loop needs a look in too.
+const byte longestStay = ticsFor(longestStayMicros, ticDivisor);   // The same, in tics, which is how doTimeslices() counts.
+
+static_assert(ticsFor(maxSlotsPerSlice * 70UL, ticDivisor) <= longestInterval, "maxSlotsPerSlice slots don't fit in a timeslice");
+
+class Timer2Scheduler
+{
+    TimeslicedTask *tasks[maxTasks];
+    uint16_t wakeAt[maxTasks];        // For each task, the tic on our clock when its next timeslice should start.
+    uint16_t now;                     // Our clock: TIMER2 tics as at lastCount. It wraps, so compare differences.
+    byte lastCount;                   // TCNT2 when we last brought now up to date.
+    byte entryTics;                   // How many tics it takes from the compare match to get into doTimeslices().
+    byte numTasks;
+    byte idleTasks;                   // Bit i set: task i has NothingToDo, and waits for wake().
+    bool timerRunning;
+    bool coasting;                    // The timer is on coastClockSelect for a long wait, not ticClockSelect.
+    bool stopped;                     // Every task is idle, so TIMER2 and its interrupt are off.
+
+    // TCNT2 laps every 256 of its tics, but we never let it go a whole lap without looking
+    // (longestInterval), so how far it has come since last time is all we need.
+    void catchUp()
+    {
+      byte count = TCNT2;
+      byte elapsed = count - lastCount;
+      lastCount = count;
+      now += coasting ? elapsed * coastFactor : elapsed;
+    }
+
+    // Onto the coarse prescaler for a long wait, or back onto our own tics.  Right up to
+    // the switch, TCNT2 counted in the old tics, and right after it, in the new ones.
+    // Anything between is lost, which only ever makes somebody a little late.
+    void switchClock(bool coast)
+    {
+      catchUp();
+      TCCR2B = coast ? coastClockSelect : ticClockSelect;
+      lastCount = TCNT2;
+      coasting = coast;
+    }
+
+    // The next interrupt, tics from now on whatever TIMER2 is running from.  At least 2, so
+    // the counter can't get past OCR2A while we write it, and we'd wait a whole lap.
+    void interruptIn(byte tics)
+    {
+      TIFR2 = (1 << OCF2A);         // Forget any match against an old OCR2A.
+      OCR2A = TCNT2 + tics;
+    }
+
+  public:
+
+    void add(TimeslicedTask *task)
+    { // Pre: interrupts already disabled;
+      for (byte i = 0; i < numTasks; i++) {
+        if (tasks[i] == task) return;         // begin() called again, nothing to do.
+      }
+      if (numTasks >= maxTasks) {
+        digitalWrite(LED_ALERT, HIGH);
+        Serial.println("Too many buses for Timer2Scheduler");
+        return;
+      }
+      tasks[numTasks] = task;
+      idleTasks |= 1 << numTasks;     // Nothing to do yet: its first timeslice comes when it's woken.
+      numTasks++;
+    }
+
+    void startTimer()
+    { // Pre: interrupts already disabled;
+      if (timerRunning) return;   // A second bus must not disturb the timing of the first.
+
+      // https://www.instructables.com/id/Arduino-Timer-Interrupts/
+      // Page references refer to  https://www.sparkfun.com/datasheets/Components/SMD/ATMega328.pdf
+      TCCR2A = 0;                   // set entire TCCR2A register to 0  pg158.  Normal mode: it just counts, and laps.
+      TCCR2B = 0;                   // same for TCCR2B
+      TCNT2  = 0;   //initialize counter value to 0
+      lastCount = 0;
+      OCR2A = 255;  // set our first interrupt event to occur as far into the future possile
+      TIFR2 = (1 << OCF2A);
+      TIMSK2 |= (1 << OCIE2A);      // enable timer compare interrupt
+      TCCR2B |= ticClockSelect;  // pg 162./ Pg188  Attach timer to prescaler source. This starts the timer
+      timerRunning = true;
+    }
+
+    // A task that has just been given new work wants a timeslice now, not when its holdoff
+    // (perhaps a long sleep) runs out.  So bring our clock up to date and ask for an interrupt
+    // straight away.  Nobody else's deadline moves.  If the timer was stopped, our clock
+    // stood still with it, which is fine: nobody had a deadline.
+    void wake(TimeslicedTask *task)
+    { // Pre: interrupts already disabled;
+      if (!timerRunning) return;
+      for (byte i = 0; i < numTasks; i++) {
+        if (tasks[i] != task) continue;
+        if (coasting || stopped) {
+          switchClock(false);       // Back on our own tics (and started, if it was stopped).
+          stopped = false;
+        }
+        catchUp();
+        wakeAt[i] = now;
+        idleTasks &= ~(1 << i);
+        interruptIn(2);
+        TIMSK2 |= (1 << OCIE2A);
+      }
+    }
+
+    // Whether any task but this one has work, and so takes timeslices.
+    bool othersBusy(TimeslicedTask *task)
+    { // Pre: interrupts already disabled;
+      for (byte i = 0; i < numTasks; i++) {
+        if (tasks[i] != task && !(idleTasks & (1 << i))) return true;
+      }
+      return false;
+    }
+
+    // Called by the ISR.  Gives a timeslice to every task whose deadline has come, and moves
+    // OCR2A on to the next one.
+    void doTimeslices()
+    {
+      if (coasting) {
+        switchClock(false);         // Back onto our own tics for the timeslices.
+      }
+      else {
+        entryTics = TCNT2 - OCR2A;  // How late we are for the match we were woken by.
+      }
+
+      catchUp();
+      uint16_t enteredAt = now;
+      int16_t soonest;
+      while (true) {
+        // Always the task that has been waiting longest next, so that nobody is late by
+        // more than one other timeslice.
+        catchUp();
+        byte next = 0;
+        soonest = 32767;
+        for (byte i = 0; i < numTasks; i++) {
+          if (idleTasks & (1 << i)) continue;
+          int16_t wait = (int16_t)(wakeAt[i] - now);
+          if (wait < soonest) {
+            soonest = wait;
+            next = i;
+          }
+        }
+        if (soonest > 0) break;
+        // Somebody is overdue.  But with enough buses busy, somebody always is: once we've
+        // been in here longestStay, let everybody else in, and come straight back.
+        if ((uint16_t) (now - enteredAt) > longestStay) break;
+        uint16_t startedAt = now;
+        unsigned int holdoff = tasks[next]->doTimeslice();
+        if (holdoff == NothingToDo) {
+          idleTasks |= 1 << next;
+          continue;
+        }
+        wakeAt[next] = startedAt + holdoff;   // From when this timeslice started, however long it took.
+      }
+      if (idleTasks == (1 << numTasks) - 1) {
+        // Nobody has anything to do.  Stop, until wake().
+        TIMSK2 &= ~(1 << OCIE2A);
+        TCCR2B = 0;
+        stopped = true;
+        return;
+      }
+
+      // Nobody is due yet, so leave, and have the timer bring us back: never wait for them in
+      // here, with everything else held up behind us.  Ask early by as long as getting in took.
+      soonest -= entryTics;
+      if (soonest > longestInterval) {
+        // Nobody due for a while: coast, and wake up one slow tic early.
+        switchClock(true);
+        soonest = soonest / coastFactor - 1;
+        if (soonest > longestInterval) soonest = longestInterval;
+      }
+      if (soonest < 2) soonest = 2;   // Came due while the others ran: as soon as we can.
+      interruptIn(soonest);
+    }
+};
+
+Timer2Scheduler busScheduler;   // The one TIMER2, shared by every reader.
+
+// How many buses ("lanes") a pin mask covers: one per bit.
+constexpr byte busLanes(byte mask)
+{
+  return mask ? (mask & 1) + busLanes(mask >> 1) : 0;
+}
+
+template <class BusPort, byte busPinMask>
+class AsyncTemperatureReader : public TimeslicedTask
 {
 
   public:
@@ -199,11 +644,168 @@ class AsyncTemperatureReader
     // Usually used for reading the device's scratchpad, but sometimes
     // we can read the device's ID here.
 
+    const byte (*deviceList)[8];  // For whole-fleet scans: the devices to read, ...
+    byte (*scratchPads)[9];       // ... a scratchpad buffer for each of them,
+    byte numDevices;              // ... and how many there are.
+    bool fleetTemperatureOnly;    // Truncate each of those reads to the temperature bytes.
+    byte crc;                     // Dallas CRC8 of the bits read so far, updated as each bit arrives.
+    byte heardOnes;               // Port bits (lanes) that have sent at least one 1 bit since then.
+
+    // Retrying failed scratchpad reads
+    byte maxRetries;              // How many times to retry a failed read before giving up on it.
+    byte retriesLeft;             // For the device being read now.
+    byte *retryCounts;            // Optional, supplied by the user: retries so far, per device.
+    byte deviceIndex;             // Where the device being read now is in deviceList (0 for single reads).
+    byte readNumBits;             // What ReadScratchPad was asked for, in case we have to do it again.
+    bool readMultiDrop;
+    byte priorErrors;             // Error bits from before the read now in progress.
+
+    // Bit-sliced mode.  If busPinMask has several bits, each one is a separate bus (a "lane")
+    // on the same port.  Every slot drives all of them at once, and one PINx read samples
+    // them all, so a row of numLanes devices, one per lane, is read in the time of one.
+    // Lane l is the l'th bit of the mask, counting from bit 0.
+    static const byte numLanes = busLanes(busPinMask);
+    const byte *laneAddr[numLanes];  // Per lane: the device being read, NULL if the lane sits this row out, ...
+    byte *laneBuf[numLanes];         // ... its shadow scratchpad, ...
+    byte laneCrc[numLanes];          // ... and the CRC of what it has sent so far.
+    byte lanesInUse;                 // Port bits of the lanes taking part in the current read.
+    byte laneErrors;                 // Port bits of the lanes whose read failed (no presence pulse, bad CRC).
+
+    // Background ROM search: SensorDiscovery's algorithm, as opcodes.
+    byte (*searchTable)[8];       // Supplied by the user: where the IDs we find go, ...
+    byte searchTableSize;         // ... how many it can hold, ...
+    byte numFound;                // ... and how many it holds so far.  The next pass works in searchTable[numFound].
+    byte searchFork[8];           // 64 bits: where the search tree still has a right branch to backtrack to.
+    byte searchResponse;          // The ID bit and its complement, as SensorDiscovery's response.
+    byte searchCommand;           // SEARCHROM for every device, ALARMSEARCH for just those in alarm.
+
+    // Writing TH, TL and the config register
+    byte writeBuf[3];             // What follows WRITESCRATCH: TH, TL, and for DS18B20s the config byte, ...
+    byte writeLen;                // ... 2 or 3 of them.
+    byte conversionBits;          // The resolution we schedule conversion waits for: the finest any device was set to.
+    unsigned int pollInterval;    // Tics between read slots while polling a conversion.  0: no polling, wait it out.
+    byte edgeTics;                // How far into this timeslice its bus edge comes: a yield is from there, not from the start.
+    byte slotsPerSlice;           // How many bit slots SendRemainingBits and ReadRemainingBits do before they yield.
+    byte sliceSlots;              // What this timeslice gets: 1 while other buses have work.
+    byte slotsLeft;               // Of those, how many are left.
+    byte sliceStartCount;         // TCNT2 when this timeslice started, for edgeTics.
+    unsigned long conversionStartedAt;  // micros() when the last STARTCONVO went out.
+    unsigned int learnedConversionMs;   // How long conversions on this bus have been taking.  0: no idea yet.
+    bool polledBusy;              // Whether any poll of this conversion found it still busy.
+    unsigned int lastConversionMs;      // How long the last conversion we polled took.
+
+    // Per-device conversion times, for the devices in deviceList.
+    unsigned int *conversionProfile;    // Supplied by the user: a moving average per device, in ms.  0: not timed yet.
+    bool sleptOnProfile;          // The sleep in this conversion came from the profile, ...
+    bool profileStale;            // ... and the devices have turned out quicker than that: don't go by it until it's redone.
+
+    bool parasitePowered;         // Some device on the bus (on any lane) takes its power from the line.
+
+    // Finished readings, for the main loop.  Only the interpreter moves ringHead, and only
+    // the main loop moves ringTail, so neither side needs to turn interrupts off.
+    TemperatureReading *ring;     // Supplied by the user, ...
+    byte ringSize;                // ... with room for ringSize - 1 readings.
+    volatile byte ringHead;       // Where the interpreter puts the next reading.
+    volatile byte ringTail;       // Where the main loop takes the next one from.
+    volatile byte readingsDropped;  // Readings that found the ring full.
+
+    // Continuous sampling
+    unsigned int samplePeriodMs;  // How often to convert and read the whole list.
+    unsigned long sampleCycleAt;  // millis() when the current cycle was due to start.
+    bool keepSampling;            // Cleared by stopSampling(): NextSample lets the program end.
+
+    // Requests waiting for the bus.  An entry point writes down what it was asked for, and
+    // the interpreter pushes its program when the one before it is done.
+    static const byte DoRead = 1;
+    static const byte DoReadID = 2;
+    static const byte DoFind = 3;
+    static const byte DoReadAlarmed = 4;
+    static const byte DoReset = 5;
+    static const byte DoWrite = 6;
+    static const byte DoProfile = 7;
+    static const byte DoPowerSupply = 8;
+    static const byte DoConvertAll = 9;
+    static const byte DoReadList = 10;
+    static const byte DoSample = 11;
+    static const byte DoTestTimings = 12;
+    static const byte DoCalibrate = 13;
+
+    struct Request {
+      byte kind;                  // One of the Do... above.
+      byte ticket;
+      byte a, b, c, d;            // Small arguments, as each kind needs them.
+      unsigned int n;
+      const void *p;              // The caller's address or list, ...
+      void *q;                    // ... and buffer or table.
+    };
+
+  public:
+    static const byte requestQueueSize = 4;
+    static const byte ticketMemory = 8;   // How many of the latest tickets getTicketStatus() remembers.
+    static_assert(ticketMemory > requestQueueSize + 2, "Remember at least every queued ticket, the running one and the sampling one");
+
+  private:
+    Request queue[requestQueueSize];
+    byte queueHead;               // The next request to start, ...
+    byte queueLength;             // ... and how many are waiting.
+    byte lastTicket;              // The ticket handed out last.
+    byte currentTicket;           // The request running now.
+    byte ticketOf[ticketMemory];  // Which ticket each slot below is about, ...
+    byte ticketStatus[ticketMemory];  // ... and how it went: StillBusy, or its error bits.
+    Request sampling;             // What sampleContinuouslyAsync() was asked for, while it runs.
+
+    // Slot timings, in tics: defaultSlotTics, until calibrateTimingsAsync() finds out better.
+    byte slotTics[numSlotTimings];
+    static const byte calibrationYields = 16;   // Yields timed in a run, ...
+    static const byte calibrationRuns = 4;      // ... and runs, of which the quickest counts.
+    unsigned long calibratedAt;       // micros() at the last Calibrate timeslice, ...
+    unsigned long calibrationMicros;  // ... how long this run's yields have taken, all told, ...
+    unsigned long quickestRun;        // ... and the quickest run so far.
+    bool runDisturbed;                // Another reader had the timer during this run, so it doesn't count.
+    int overheadMicros;               // What a yield costs on top of its tics, as far as we know.
+
 
   private:
 
+    static inline void pullBusLow()
+    {
+      BusPort::pullLow(busPinMask);
+    }
+
+    static inline void releaseBus()
+    {
+      BusPort::release(busPinMask);
+    }
+
+    static inline byte sampleBus()
+    {
+      return BusPort::sample(busPinMask) != 0;    // Read value of 1-wire pin.
+    }
+
+    static inline byte sampleLanes()
+    {
+      return BusPort::sample(busPinMask);          // All the lanes at once, as port bits.
+    }
+
+    // One read slot, done inline.  The caller yields for the whole slot (Slot70), counted from its start.
+    static inline byte readSlot()
+    {
+      pullBusLow();
+      _delay_us(6);
+      releaseBus();
+      _delay_us(9);
+      return sampleBus();
+    }
+
+    // Fold one more bit into a Dallas CRC8.  Polynomial x^8 + x^5 + x^4 + 1, bits arrive LSB first.
+    static inline byte crcBit(byte crc, byte bit)
+    {
+      return ((crc ^ bit) & 0x01) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+
     void flushStack() {
       topOfStack = 0;
+      lanesInUse = busPinMask;   // Unless a read says otherwise, every lane is in play.
     }
 
     void showStack(char * header) // diagnostic
@@ -231,7 +833,7 @@ class AsyncTemperatureReader
       theCode[topOfStack] = opCode;
       topOfStack++;
 
-      if (topOfStack >= stackHighTide) {
+      if (topOfStack > stackHighTide) {   // Only a new high is worth the snapshot.
         stackHighTide = topOfStack;
 
         // snapshot the stack
@@ -256,23 +858,89 @@ class AsyncTemperatureReader
       push(SendRemainingBits);
     }
 
+    void pushProgram(byte program)
+    {
+      push(program);
+      push(0);               // pc: its first step
+      push(RunProgram);
+    }
+
+    // The start of a bit slot.  If it isn't the first in this timeslice (see setSlotsPerSlice()),
+    // the ones before it ran inline, however long they took, so measure how far in we are:
+    // the yield at the end of the timeslice counts from here.  +1 because TCNT2 rounds down.
+    inline void startSlot()
+    {
+      if (slotsLeft < sliceSlots) edgeTics = (byte) (TCNT2 - sliceStartCount) + 1;
+      pullBusLow();
+    }
+
+    // The end of a bit slot.  True if there's room for another in this timeslice, and what
+    // comes next is another bit slot (which starts with startSlot()): then the caller
+    // busy-waits out the rest of this one, instead of yielding.
+    inline bool anotherSlot()
+    {
+      if (slotsLeft == 0 || --slotsLeft == 0 || topOfStack == 0) return false;
+      byte next = theCode[topOfStack - 1];
+      return next == SendRemainingBits || next == ReadRemainingBits || next == SendRemainingLaneBits || next == SendRemainingIDBytes;
+    }
+
     void YieldFor(byte numberOfTics)
     {
       push(numberOfTics);
       push(Yield);
     }
 
+    void pushSleep(unsigned int ms)
+    {
+      push(ms >> 8);
+      push(ms & 0xFF);
+      push(Sleep);
+    }
+
+    void pushWaitForDevices(unsigned int ms)
+    {
+      if (parasitePowered) {    // They can't wait on the pull-up resistor: give them the power.
+        push(ms >> 8);
+        push(ms & 0xFF);
+        push(StrongPullup);
+        return;
+      }
+      push(ms >> 8);
+      push(ms & 0xFF);
+      push(WaitForDevices);
+    }
+
+    // The wait after STARTCONVO.  Polling, unless that's turned off: then a wait sized for
+    // the resolution the devices were set to.  Parasitic devices can't be polled (a read
+    // slot would cut their power), so they always get the timed wait, with a strong pull-up.
+    void pushWaitForConversion(bool listed = false)
+    {
+      if (pollInterval > 0 && !parasitePowered) {
+        push(listed);
+        push(ConversionStarted);
+      }
+      else {
+        pushWaitForDevices(conversionMillis(conversionBits) + 1);   // +1 for the rounding
+      }
+    }
+
 
   public:
 
-    byte doTimeslice()
+    unsigned int doTimeslice()   // Our TimeslicedTask slot, pumped by busScheduler.
     {
 
       // Pre: interrupts are disabled.
+      edgeTics = 0;
+      sliceSlots = slotsPerSlice;
+      if (sliceSlots > 1 && busScheduler.othersBusy(this)) sliceSlots = 1;   // They can't wait on us.
+      slotsLeft = sliceSlots;
+      sliceStartCount = TCNT2;
       do {
 
-        if (topOfStack == 0) {   // If nothing to do, just keep slowly idling by ticking the counter over
-          return 255;   // Maximum holdoff
+        if (topOfStack == 0) {   // If nothing to do, sleep.  An entry point will wake us when there is.
+          if (queueLength == 0) return NothingToDo;
+          startNextRequest();
         }
 
         byte opCode = theCode[--topOfStack];
@@ -287,8 +955,11 @@ class AsyncTemperatureReader
 
           case  BusRelease:
             {
+              // Whatever comes next in this timeslice goes on the bus 10us late, and the
+              // scheduler counts a yield from the start of the timeslice.  So add it on.
               releaseBus();
               _delay_us(10);
+              edgeTics = Micros10;
             }
             break;
 
@@ -296,7 +967,8 @@ class AsyncTemperatureReader
               //  top of stack is the number of bits still to send
               // below that is the remainder of the byte we are presently sending.
               byte theBitToSend = theCode[topOfStack - 2] & 0x01;
-              if (--theCode[topOfStack - 1] > 0) { // more work remaining after this bit?
+              bool lastBit = --theCode[topOfStack - 1] == 0;
+              if (!lastBit) { // more work remaining after this bit?
                 theCode[topOfStack - 2] >>= 1;
                 push(SendRemainingBits);
               }
@@ -309,43 +981,126 @@ class AsyncTemperatureReader
                 // Specs, pg 2 of  http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
                 // Drive bus low, delay 6 μs.
                 // Release bus, delay 64 μs
-                pullBusLow();
+                startSlot();
                 _delay_us(6);
                 releaseBus();
-                YieldFor(Micros64);
+                if (anotherSlot()) _delay_us(64);
+                else YieldFor(slotTics[Slot70]);   // The whole slot, from when it started.
               }
               else {
                 // Specs, pg 2 of  http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
                 // Drive bus low, delay 60 μs.
                 // Release bus, delay 10 μs.
-                pullBusLow();
-                push(BusRelease);
-                YieldFor(Micros60);
+                // The release is done here, not in a later timeslice: if that came late, behind
+                // the other buses, the low would stretch past 120us and the devices would reset.
+                startSlot();
+                _delay_us(60);
+                releaseBus();
+                if (anotherSlot()) _delay_us(10);
+                else if (lastBit && parasitePowered) {
+                  // STARTCONVO and COPYSCRATCH end with a 0, and a strong pull-up may have to be
+                  // on within 10us of it: carry straight on, as OneWire does, measuring how far
+                  // into the timeslice we are for whatever yields next.
+                  _delay_us(10);
+                  edgeTics = (byte) (TCNT2 - sliceStartCount) + 1;
+                }
+                else YieldFor(slotTics[Slot70]);   // The whole slot, from when it started.
+              }
+            }
+            break;
+
+          case SendRemainingLaneBits: {
+              // As SendRemainingBits, but each lane sends its own device's ID.  All lanes go low
+              // together; the ones sending a 1 (and any sitting this row out) are let go after 6us,
+              // and the ones sending a 0 stay low for the rest of the slot.
+              byte bitNo = 8 - theCode[topOfStack - 1];
+              byte byteNo = theCode[topOfStack - 2];
+              if (--theCode[topOfStack - 1] > 0) {
+                push(SendRemainingLaneBits);
+              }
+              else {
+                topOfStack -= 2;
+              }
+
+              byte ones = 0;
+              byte lane = 0;
+              for (byte m = 1; m != 0; m <<= 1) {
+                if (busPinMask & m) {
+                  if (laneAddr[lane] == NULL || (laneAddr[lane][byteNo] >> bitNo) & 0x01) ones |= m;
+                  lane++;
+                }
+              }
+
+              startSlot();
+              _delay_us(6);
+              BusPort::release(ones);
+              if (ones != busPinMask) {       // Somebody is writing a 0: let go of them on time, here.
+                _delay_us(54);
+                releaseBus();
               }
+              if (anotherSlot()) _delay_us(10);
+              else YieldFor(slotTics[Slot70]);   // The whole slot, from when it started.
             }
             break;
 
-          case  ClearBusyStatus: {
-              status  &= (~StillBusy);
+          case  ClearBusyStatus: {   // The end of a request: say how it went.
+              ticketStatus[currentTicket % ticketMemory] = status & (NoDeviceOnBus | CRCError | OtherBusesBusy);
+              status &= ~OtherBusesBusy;   // The ticket has it.  Left in status, busyWait() would never see 0.
+              if (queueLength == 0) {
+                status  &= (~StillBusy);   // Only once there's nothing else to do.
+              }
             }
             break;
 
           case ReadScratchPad: {
               // Grab the parameter that tells if we have just one device, or many devices, on the bus.
               bool multiDropBus = pop();
-              // Push what we need to do onto the stack, back to front...
-              push(Reset);
-              push(72);             // number of bits we want to read.
+              byte numBits = pop();
+              readMultiDrop = multiDropBus;
+              readNumBits = numBits;
+              // Put aside the error bits from earlier steps, so RetryIfFailed sees only this read's errors.
+              priorErrors |= status & (NoDeviceOnBus | CRCError);
+              status &= ~(NoDeviceOnBus | CRCError);
+              laneErrors = 0;
+              pushProgram(multiDropBus ? ReadSelectedProgram : ReadSkipRomProgram);
+            }
+            break;
+
+          case ReadScratchPadBits: {
+              if (readNumBits == 72) {  // Only the whole scratchpad has a CRC to check
+                push(CheckCRC);
+              }
+              push(readNumBits);    // number of bits we want to read.
               push(0);              // index of next bit to store [0..72]
               push(ReadRemainingBits);
-              pushSendOneByte(READSCRATCH);
-              if (multiDropBus) {
-                push(StartIDSend);
+            }
+            break;
+
+          case RunProgram: {
+              byte program = theCode[topOfStack - 2];
+              byte pc = theCode[topOfStack - 1];
+              const byte *step = programSteps(program) + pc;
+              byte n = pgm_read_byte(step);
+              if (n == 0) {         // The end
+                topOfStack -= 2;
+                break;
+              }
+              pc += n + 1;
+              if (pgm_read_byte(programSteps(program) + pc) == 0) {
+                topOfStack -= 2;    // That's the last step: don't come back.
               }
               else {
-                pushSendOneByte(SKIPROMWILDCARD);
+                theCode[topOfStack - 1] = pc;
+                push(RunProgram);
               }
-              push(Reset);
+              for (byte i = 1; i <= n; i++) {
+                push(pgm_read_byte(step + i));
+              }
+            }
+            break;
+
+          case WaitForConversion: {
+              pushWaitForConversion(pop());
             }
             break;
 
@@ -358,21 +1113,46 @@ class AsyncTemperatureReader
               //   Delay 55 μs.
 
               digitalWrite(debugPin, LOW);
-              pullBusLow();
+              startSlot();
               _delay_us(6);
               releaseBus();
               _delay_us(9);
-              byte thisBit = sampleBus();
+              byte bits = sampleLanes();
               digitalWrite(debugPin, HIGH);
 
               byte bitPos = theCode[topOfStack - 1];       // a value 0.. that counts up as bits arrive
+              if (bitPos == 0) heardOnes = 0;
+              heardOnes |= bits;
               byte numBitsToRead = theCode[topOfStack - 2]; // a value that tells us when to exit the loop
-
-              // Shift the new bit into the receive buffer
-              if (thisBit)  {  // we need to store the 1 bit
-                byte mask = 0x01 << (bitPos % 8); // create a mask
-                byte inputBufIndx = (bitPos / 8);
-                inputBuf[inputBufIndx] |= mask;
+              byte mask = 0x01 << (bitPos % 8);            // where the bit goes in its byte
+              byte inputBufIndx = (bitPos / 8);
+
+              if (numLanes == 1) {
+                byte thisBit = bits != 0;
+                // Fold the bit into the CRC now, rather than making a pass over the whole
+                // buffer at the end.
+                if (bitPos == 0) crc = 0;
+                crc = crcBit(crc, thisBit);
+
+                // Shift the new bit into the receive buffer
+                if (thisBit)  {  // we need to store the 1 bit
+                  inputBuf[inputBufIndx] |= mask;
+                }
+              }
+              else {
+                // The one sample has a bit for every lane: share it out to their shadow scratchpads.
+                byte lane = 0;
+                for (byte m = 1; m != 0; m <<= 1) {
+                  if (busPinMask & m) {
+                    byte thisBit = (bits & m) != 0;
+                    if (bitPos == 0) laneCrc[lane] = 0;
+                    laneCrc[lane] = crcBit(laneCrc[lane], thisBit);
+                    if (thisBit && laneBuf[lane] != NULL) {
+                      laneBuf[lane][inputBufIndx] |= mask;
+                    }
+                    lane++;
+                  }
+                }
               }
 
               if (++theCode[topOfStack - 1] < numBitsToRead) { // if still more bits need to be read
@@ -381,80 +1161,576 @@ class AsyncTemperatureReader
               else {
                 topOfStack -= 2;  // lose the operands, we're done here.
               }
-              YieldFor(Micros55);
+              if (anotherSlot()) _delay_us(55);
+              else YieldFor(slotTics[Slot70]);
             }
             break;
 
-          case StartIDSend: {
-              idByteIndex = 0;
-              push(SendRemainingIDBytes);
-              pushSendOneByte(SELECTDEVICE);
+          case CheckCRC: {
+              // Running the CRC over the data and its own CRC byte leaves zero.  But so does
+              // a block of nothing but zeros, which is what a bus stuck low reads as: no
+              // device sends that, so it's a failure too.
+              if (numLanes == 1) {
+                if (crc != 0 || heardOnes == 0) {
+                  status |= CRCError;
+                }
+              }
+              else {
+                byte lane = 0;
+                for (byte m = 1; m != 0; m <<= 1) {
+                  if (busPinMask & m) {
+                    if ((lanesInUse & m) && (laneCrc[lane] != 0 || !(heardOnes & m))) laneErrors |= m;
+                    lane++;
+                  }
+                }
+                if (laneErrors) {
+                  status |= CRCError;
+                }
+              }
             }
             break;
 
-          case SendRemainingIDBytes: {
-              if (idByteIndex < 8) {
-                push(SendRemainingIDBytes);              // There will still be more to send after this one.
-                push(deviceAddr[idByteIndex++]);
-                push(8); // send 8 bits
-                push(SendRemainingBits);
+          case RetryIfFailed: {
+              if ((status & (NoDeviceOnBus | CRCError)) && retriesLeft > 0) {
+                retriesLeft--;
+                if (retryCounts != NULL) {
+                  if (numLanes == 1) {
+                    if (retryCounts[deviceIndex] < 255) retryCounts[deviceIndex]++;
+                  }
+                  else {        // Only the lanes that failed count a retry, though they all read again.
+                    byte lane = 0;
+                    for (byte m = 1; m != 0; m <<= 1) {
+                      if (busPinMask & m) {
+                        byte *count = &retryCounts[deviceIndex * numLanes + lane];
+                        if ((laneErrors & m) && *count < 255) (*count)++;
+                        lane++;
+                      }
+                    }
+                  }
+                }
+                status &= ~(NoDeviceOnBus | CRCError);
+                clearBuffers();
+                push(readNumBits);
+                push(readMultiDrop);
+                push(ReadScratchPad);
+              }
+              else {       // Done with this device, for better or worse.
+                publishReadings(status & (NoDeviceOnBus | CRCError));
+                status |= priorErrors;
+                priorErrors = 0;
               }
             }
             break;
 
-
-          case Reset: {
-              // Specs, pg 2 of  http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
-              // Drive bus low, delay 480 μs.
-              // Release bus, delay 70 μs.
-              // Sample bus: 0 = device(s) present,
-              //             1 = no device present
-              // Delay 410 μs.
-              // Put operations on back to front ...
-              YieldFor(Micros410);
-              push(BusSample);
-              YieldFor(Micros70);
-              push(BusRelease);
-              YieldFor(Micros480);
-              push(BusLow);
+          case SearchNextDevice: {
+              // The same tree walk as SensorDiscovery::findNextDevice(), but each pair of
+              // read slots and each write slot is its own timeslice.
+              bool firstPass = pop();
+              if (numFound >= searchTableSize) break;   // The table is full: stop here.
+              byte *id = searchTable[numFound];
+              byte frozenTreeDepth = 255;                // Up to here we just follow the ID, after that we explore.
+              if (firstPass) {
+                memset(id, 0, 8);
+                memset(searchFork, 0, 8);
+              }
+              else {
+                for (byte i = 64; i-- > 0; ) {
+                  if (searchFork[i / 8] & (1 << (i % 8))) {
+                    frozenTreeDepth = i;
+                    break;
+                  }
+                }
+                if (frozenTreeDepth == 255) break;       // No forks left to explore: we've found them all.
+                for (byte i = frozenTreeDepth + 1; i < 64; i++) {
+                  id[i / 8] &= ~(1 << (i % 8));          // Forget the old path below the fork, ...
+                }
+                searchFork[frozenTreeDepth / 8] &= ~(1 << (frozenTreeDepth % 8));
+                id[frozenTreeDepth / 8] |= 1 << (frozenTreeDepth % 8);  // ... and go right at the fork this time.
+              }
+              push(false);
+              push(SearchNextDevice);  // Come back for the next device after this one.
+              push(SearchFoundDevice);
+              push(frozenTreeDepth);   // SearchBit keeps this below its own opands, see below.
+              push(0);                 // depth
+              push(0);                 // phase
+              push(SearchBit);
+              pushSendOneByte(searchCommand);
+              push(Reset);
             }
             break;
 
-          case Yield: {
-              byte tics = pop();
-              return (tics);
+          case SearchBit: {
+              byte phase = theCode[topOfStack - 1];
+              byte depth = theCode[topOfStack - 2];
+              byte frozenTreeDepth = theCode[topOfStack - 3];
+              byte *id = searchTable[numFound];
+              byte bitMask = 1 << (depth % 8);
+              byte thisBit = readSlot();
+
+              if (phase == 0) {         // That was the ID bit of everyone still in contention.  Now its complement.
+                searchResponse = thisBit << 1;
+                theCode[topOfStack - 1] = 1;
+                push(SearchBit);
+                YieldFor(slotTics[Slot70]);
+                break;
+              }
+
+              searchResponse |= thisBit;
+              if (searchResponse == 3) {  // 11  Nobody answered.
+                // Unless it's an alarm search with nobody in alarm, did they fall off the bus?
+                if (depth > 0 || searchCommand != ALARMSEARCH) {
+                  status |= NoDeviceOnBus;
+                }
+                // Abandon the search: lose our opands and SearchFoundDevice, and the
+                // SearchNextDevice (and its opand) below them, but leave whatever comes after.
+                topOfStack -= 6;
+                push(Reset);
+                YieldFor(slotTics[Slot70]);     // After the rest of the read slot: 70us from its start.
+                break;
+              }
+              byte chooseRight;
+              switch (searchResponse) {
+                case 2:                 // 10  Everyone still in contention has a 1 here.
+                  chooseRight = 1;
+                  break;
+                case 1:                 // 01  Everyone still in contention has a 0 here.
+                  chooseRight = 0;
+                  break;
+                default:                // 00  Some of each.  Go left, and come back later to go right.
+                  if (depth <= frozenTreeDepth && frozenTreeDepth != 255) {
+                    chooseRight = (id[depth / 8] & bitMask) != 0;
+                  }
+                  else {
+                    chooseRight = 0;
+                    searchFork[depth / 8] |= bitMask;
+                  }
+                  break;
+              }
+
+              if (chooseRight) id[depth / 8] |= bitMask;
+              else id[depth / 8] &= ~bitMask;
+              if (depth == 0) {
+                crc = 0;
+                heardOnes = 0;
+              }
+              crc = crcBit(crc, chooseRight);
+              if (chooseRight) heardOnes = busPinMask;
+
+              if (depth < 63) {         // Next time round, the next bit down the tree.
+                theCode[topOfStack - 1] = 0;
+                theCode[topOfStack - 2] = depth + 1;
+                push(SearchBit);
+              }
+              else {
+                topOfStack -= 3;        // lose the operands
+              }
+              push(chooseRight);        // Devices that don't have this bit drop out of the running.
+              push(1);
+              push(SendRemainingBits);
+              YieldFor(slotTics[Slot70]);       // But first, the rest of the read slot (70us from its start).
             }
             break;
 
-          case BusSample: {
-              releaseBus();
-              _delay_us(2);
-              byte thisBit = sampleBus();
-              if (thisBit == 1) {
-                // No device present on bus.  Set the status accordingly, and abandon all pending computation.
-                //  flushStack();
-                status |= NoDeviceOnBus;
-                digitalWrite(LED_ALERT, HIGH);
+          case SearchFoundDevice: {
+              // The last byte of the ID is the CRC of the other seven.
+              if (heardOnes == 0) {
+                // An ID of all zeros passes that too, but no device has family code 0: it's a
+                // bus stuck low, and every fork it "found" on the way is just as bogus.  Give
+                // up: lose the SearchNextDevice (and its opand) below us.
+                status |= CRCError;
+                topOfStack -= 2;
+              }
+              else if (crc != 0) {
+                status |= CRCError;     // Don't keep it.  The next pass overwrites it.
+              }
+              else if (++numFound < searchTableSize) {
+                memcpy(searchTable[numFound], searchTable[numFound - 1], 8);  // The next pass starts from this path.
               }
-              // If there is a device present, we can just carry on
-              YieldFor(Micros55);
             }
             break;
 
-          case WaitForBusRelease:
-            { // Here is where we can repeat this test-and-wait again cycle a really long time if
-              // we have a slow device converting temperatures
-              releaseBus();
-              _delay_us(2);
-              byte thisBit = sampleBus();
-              if (thisBit == 0) // No, some device is still holding the bus LOW
-              {
-                push(WaitForBusRelease);  // Loop around to try again after about
-                YieldFor(255);
-                //   toggleDebugLine();        // Rattle the debug line so we can watch it on the scope
+          case Calibrate: {
+              // How long a yield really takes, from one timeslice to the next: the tics we asked
+              // for, plus whatever the scheduler couldn't make up for.  Anything else that holds
+              // us up only ever makes a run longer, so the quickest run is the one to believe.
+              // And a run while another reader has the timer too is no measure of ours at all.
+              byte left = theCode[topOfStack - 1];
+              unsigned long now = micros();
+              if (left == calibrationRuns * calibrationYields) {   // The first one just starts the clock.
+                quickestRun = 0xFFFFFFFFUL;
+                calibrationMicros = 0;
+                runDisturbed = false;
               }
-              else {   // yay, all devices are ready, clear the waiting status and get on with other things
-                status &= ~DevicesAreBusy;
+              else {
+                calibrationMicros += now - calibratedAt;
+                if (left % calibrationYields == 0) {               // The end of a run.
+                  if (!runDisturbed && calibrationMicros < quickestRun) quickestRun = calibrationMicros;
+                  calibrationMicros = 0;
+                  runDisturbed = false;
+                }
+              }
+              if (busScheduler.othersBusy(this)) runDisturbed = true;
+              calibratedAt = now;
+              if (left > 0) {
+                theCode[topOfStack - 1] = left - 1;
+                push(Calibrate);
+                return defaultSlotTics[Slot55];
+              }
+              topOfStack--;                   // lose the opand
+              if (quickestRun == 0xFFFFFFFFUL) {   // Never had the timer to ourselves: keep what we had.
+                status |= OtherBusesBusy;
+                break;
+              }
+              long measuredCycles = quickestRun * (F_CPU / 1000UL) / 1000UL / calibrationYields;
+              long overheadCycles = measuredCycles - (long) defaultSlotTics[Slot55] * ticDivisor;
+              const long maxCorrectionCycles = maxCorrectionMicros * (F_CPU / 1000000UL);
+              if (overheadCycles > maxCorrectionCycles) overheadCycles = maxCorrectionCycles;
+              if (overheadCycles < -maxCorrectionCycles) overheadCycles = -maxCorrectionCycles;
+              for (byte i = 0; i < numSlotTimings; i++) {
+                long tics = ticsFor(slotMicros[i], ticDivisor, overheadCycles);
+                slotTics[i] = tics < 1 ? 1 : tics > 255 ? 255 : tics;
+              }
+              overheadMicros = overheadCycles * 1000L / (long) (F_CPU / 1000UL);
+            }
+            break;
+
+          case NextSample: {
+              currentTicket = sampling.ticket;
+              status |= StillBusy;
+              if (!keepSampling) {          // Asked to stop: the program ends here, at its ClearBusyStatus.
+                break;
+              }
+              if (queueLength > 0) {        // Somebody else's turn first, between two cycles.
+                push(NextSample);
+                startNextRequest();
+                break;
+              }
+              unsigned long now = millis();
+              unsigned long elapsed = now - sampleCycleAt;
+              push(NextSample);             // Round again, for ever.
+              if (elapsed < samplePeriodMs) {
+                pushSleep(samplePeriodMs - elapsed);
+                break;
+              }
+              // Keep to the beat, unless a cycle took more than a whole period: then start afresh from now.
+              sampleCycleAt = elapsed < 2UL * samplePeriodMs ? sampleCycleAt + samplePeriodMs : now;
+              useFleet((const byte (*)[8]) sampling.p, sampling.a, (byte (*)[9]) sampling.q, sampling.b);
+              lanesInUse = busPinMask;      // A request in between may have left them otherwise.
+              status = StillBusy | DevicesAreBusy;   // A new cycle: the error bits start clean.
+              pushProgram(ConvertListProgram);
+            }
+            break;
+
+          case ReadFoundScratchPads: {
+              deviceList = searchTable;
+              numDevices = numFound;
+              push(0);
+              push(ReadNextScratchPad);
+            }
+            break;
+
+          case WaitForDevices: {
+              // Externally powered devices don't touch the bus while they're busy, so all we can
+              // do is wait as long as the datasheet says.  But if somebody is holding the bus
+              // low (a device that does, or a parasitic one) we can do better: WaitForBusRelease
+              // finishes as soon as they let go.
+              releaseBus();
+              _delay_us(2);
+              if (sampleLanes() != busPinMask) {
+                topOfStack -= 2;            // lose the operands
+                push(WaitForBusRelease);
+                YieldFor(255);
+                break;
+              }
+              unsigned int ms = (theCode[topOfStack - 2] << 8) | theCode[topOfStack - 1];
+              if (ms > 0) {
+                ms--;
+                theCode[topOfStack - 1] = ms & 0xFF;
+                theCode[topOfStack - 2] = ms >> 8;
+                push(WaitForDevices);
+                return Micros1000;
+              }
+              else {
+                topOfStack -= 2;
+                status &= ~DevicesAreBusy;
+              }
+            }
+            break;
+
+          case ConversionStarted: {
+              // Polling all through a 750ms conversion is hundreds of pointless timeslices.
+              // So sleep until shortly before it should be done, going by the resolution, and
+              // by how long conversions on this bus have actually been taking.  Then poll.
+              // If we're reading a list of devices and have a profile of them, it's the
+              // slowest of those we go by.
+              bool listed = pop();
+              conversionStartedAt = micros();
+              polledBusy = false;
+              push(LearnConversion);
+              push(PollConversion);
+              unsigned int history = learnedConversionMs;
+              sleptOnProfile = false;
+              if (listed && conversionProfile != NULL && !profileStale) {
+                unsigned int slowest = 0;
+                for (byte i = 0; i < numDevices; i++) {
+                  if (conversionProfile[i] == 0) {      // Not timed yet: the profile is no use.
+                    slowest = 0;
+                    break;
+                  }
+                  if (conversionProfile[i] > slowest) slowest = conversionProfile[i];
+                }
+                if (slowest > 0) {
+                  history = slowest;
+                  sleptOnProfile = true;
+                }
+              }
+              unsigned int expected = conversionMillis(conversionBits);
+              if (history > 0 && history < expected) expected = history;
+              else if (history == 0) break;       // No history yet: just poll, and learn.
+              unsigned int margin = expected / 32 + 1;
+              if (expected > margin) pushSleep(expected - margin);
+            }
+            break;
+
+          case StrongPullup: {
+              // Must be on within 10us of the end of STARTCONVO or COPYSCRATCH.  Both end with
+              // a 0 bit, and on a parasitic bus SendRemainingBits comes straight here from it.
+              BusPort::pullHigh(busPinMask);
+              unsigned int ms = (theCode[topOfStack - 2] << 8) | theCode[topOfStack - 1];
+              topOfStack -= 2;
+              push(EndStrongPullup);
+              pushSleep(ms);
+            }
+            break;
+
+          case EndStrongPullup: {
+              BusPort::endPullHigh(busPinMask);
+              status &= ~DevicesAreBusy;
+              YieldFor(slotTics[Slot55]);          // Let the line settle on the resistor before the next slot.
+            }
+            break;
+
+          case ReadPowerSupply: {
+              pullBusLow();
+              _delay_us(6);
+              releaseBus();
+              _delay_us(9);
+              if (sampleLanes() != busPinMask) {   // Somebody (on some lane) pulled it low: they're parasitic.
+                parasitePowered = true;
+              }
+              YieldFor(slotTics[Slot70]);
+            }
+            break;
+
+          case StartConversionClock: {
+              conversionStartedAt = micros();
+              polledBusy = false;
+            }
+            break;
+
+          case LearnConversion: {
+              if (polledBusy || learnedConversionMs == 0) {
+                // Moving average, weight 1/4 on the newest.
+                learnedConversionMs = learnedConversionMs == 0 ? lastConversionMs : (3 * learnedConversionMs + lastConversionMs) / 4;
+              }
+              else if (sleptOnProfile) {
+                profileStale = true;        // Done by the first poll: they're quicker than the profile says.
+              }
+              else {
+                // Done by the first poll: we overslept, and all we know is that they're quicker
+                // than we thought.  Forget it, and poll all the way through next time, to learn again.
+                learnedConversionMs = 0;
+              }
+              status &= ~DevicesAreBusy;
+              YieldFor(slotTics[Slot70]);           // The rest of PollConversion's read slot
+            }
+            break;
+
+          case RecordConversion: {
+              if (conversionProfile != NULL) {
+                unsigned int *ms = &conversionProfile[deviceIndex];
+                *ms = *ms == 0 ? lastConversionMs : (3 * *ms + lastConversionMs) / 4;
+              }
+              status &= ~DevicesAreBusy;
+              YieldFor(slotTics[Slot70]);           // The rest of PollConversion's read slot
+            }
+            break;
+
+          case ProfileNextDevice: {
+              byte i = pop();
+              if (i < numDevices && !parasitePowered && pollInterval > 0) {   // Unpolled devices just get the datasheet time: nothing to learn.
+                push(i + 1);              // Come back for the next device after this one.
+                push(ProfileNextDevice);
+                deviceIndex = i;
+                deviceAddr = deviceList[i];
+                pushProgram(ProfileDeviceProgram);
+              }
+            }
+            break;
+
+          case PollConversion: {
+              // A device busy converting answers read slots with 0, and with 1 once it's done.
+              // That works whether it's externally powered or not, and since they all share
+              // the one wire, we read 1 only when the last of them is done.
+              if (pollInterval == 0 || parasitePowered) {
+                // Not to be polled (polling was turned off after the conversion started, say):
+                // wait out the rest of the datasheet time instead, as pushWaitForConversion()
+                // would have, and that's how long it took, as far as what's under us is concerned.
+                unsigned int ms = conversionMillis(conversionBits) + 1;   // +1 for the rounding
+                unsigned int sofar = (micros() - conversionStartedAt) / 1000;
+                lastConversionMs = ms;
+                pushWaitForDevices(sofar < ms ? ms - sofar : 0);
+                break;
+              }
+              pullBusLow();
+              _delay_us(6);
+              releaseBus();
+              _delay_us(9);
+              if (sampleLanes() != busPinMask) {
+                polledBusy = true;
+                push(PollConversion);
+                return pollInterval > slotTics[Slot70] ? pollInterval : slotTics[Slot70];  // At least the whole slot
+              }
+              else {
+                // Done.  What's under us (LearnConversion or RecordConversion) makes a note of how
+                // long it took, and only then says so, before a new program can flush it away.
+                lastConversionMs = (micros() - conversionStartedAt) / 1000;
+              }
+            }
+            break;
+
+          case SendWriteBytes: {
+              byte i = pop();
+              if (i < writeLen) {
+                push(i + 1);
+                push(SendWriteBytes);
+                pushSendOneByte(writeBuf[i]);
+              }
+            }
+            break;
+
+          case CopyScratchPad: {
+              // The EEPROM write takes up to 10ms, and the devices must be left alone meanwhile.
+              status |= DevicesAreBusy;
+              pushWaitForDevices(10);
+              pushSendOneByte(COPYSCRATCH);
+              if (deviceAddr != NULL) {
+                push(StartIDSend);
+              }
+              else {
+                pushSendOneByte(SKIPROMWILDCARD);
+              }
+              push(Reset);
+            }
+            break;
+
+          case StartIDSend: {
+              idByteIndex = 0;
+              push(SendRemainingIDBytes);
+              pushSendOneByte(SELECTDEVICE);
+            }
+            break;
+
+          case ReadNextScratchPad: {
+              byte i = pop();               // On a multi-lane reader, i counts rows of numLanes devices.
+              if ((unsigned int) i * numLanes < numDevices) {
+                push(i + 1);                // Come back for the next device after this one.
+                push(ReadNextScratchPad);
+                deviceIndex = i;
+                retriesLeft = maxRetries;
+                push(loadRow(i));           // How many bits to read
+                push(true);                 // multi-drop
+                push(ReadScratchPad);
+              }
+            }
+            break;
+
+          case SendRemainingIDBytes: {
+              if (idByteIndex < 8) {
+                push(SendRemainingIDBytes);              // There will still be more to send after this one.
+                if (numLanes == 1) {
+                  push(deviceAddr[idByteIndex++]);
+                  push(8); // send 8 bits
+                  push(SendRemainingBits);
+                }
+                else {
+                  push(idByteIndex++);
+                  push(8);
+                  push(SendRemainingLaneBits);
+                }
+              }
+            }
+            break;
+
+
+          case Reset: {
+              // Specs, pg 2 of  http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
+              // Drive bus low, delay 480 μs.
+              // Release bus, delay 70 μs.
+              // Sample bus: 0 = device(s) present,
+              //             1 = no device present
+              // Delay 410 μs.
+              // The release, the 70us and the sample are all BusSample's, in one timeslice,
+              // so that a late timeslice can't miss the presence pulse.
+              // Put operations on back to front ...
+              push(BusSample);
+              YieldFor(slotTics[Slot480]);
+              push(BusLow);
+            }
+            break;
+
+          case Yield: {
+              byte tics = pop();
+              return (tics + edgeTics);
+            }
+            break;
+
+          case Sleep: {
+              unsigned int ms = (theCode[topOfStack - 2] << 8) | theCode[topOfStack - 1];
+              unsigned int chunk = ms > maxSleepMillis ? maxSleepMillis : ms;
+              ms -= chunk;
+              if (ms > 0) {
+                theCode[topOfStack - 1] = ms & 0xFF;
+                theCode[topOfStack - 2] = ms >> 8;
+                push(Sleep);
+              }
+              else {
+                topOfStack -= 2;
+              }
+              if (chunk > 0) return chunk * TicsPerMilli;
+            }
+            break;
+
+          case BusSample: {     // The second half of a reset: let go, and look for a presence pulse.
+              releaseBus();
+              _delay_us(70);
+              byte absent = sampleLanes() & lanesInUse;
+              if (absent) {
+                // No device present on bus (on one of the lanes).  Set the status accordingly, and abandon all pending computation.
+                //  flushStack();
+                status |= NoDeviceOnBus;
+                laneErrors |= absent;
+                digitalWrite(LED_ALERT, HIGH);
+              }
+              // If there is a device present, we can just carry on, after the rest of the 480us
+              // the devices get to recover in (counted from the release, at the start of this timeslice).
+              YieldFor(slotTics[Slot480]);
+            }
+            break;
+
+          case WaitForBusRelease:
+            { // Here is where we can repeat this test-and-wait again cycle a really long time if
+              // we have a slow device converting temperatures
+              releaseBus();
+              _delay_us(2);
+              if (sampleLanes() != busPinMask) // No, some device is still holding the bus (one of the lanes) LOW
+              {
+                push(WaitForBusRelease);  // Loop around to try again after about
+                YieldFor(255);
+                //   toggleDebugLine();        // Rattle the debug line so we can watch it on the scope
+              }
+              else {   // yay, all devices are ready, clear the waiting status and get on with other things
+                status &= ~DevicesAreBusy;
               }
             }
             break;
@@ -481,20 +1757,20 @@ class AsyncTemperatureReader
               switch (toGo % 5) {  // This will create a sequence of 4 different timing pulses to look at on an oscilloscope
 
                 case 0:
-                  YieldFor(Micros480);
+                  YieldFor(slotTics[Slot480]);
                   break;
                 case 1:
-                  YieldFor(Micros70);
+                  YieldFor(slotTics[Slot70]);
                   break;
                 case 2:
-                  YieldFor(Micros64);
+                  YieldFor(slotTics[Slot64]);
                   break;
                 case 3:
                   toggleDebugLine();
-                  YieldFor(Micros55);
+                  YieldFor(slotTics[Slot55]);
                   break;
                 case 4:
-                  YieldFor(Micros55);
+                  YieldFor(slotTics[Slot55]);
                   break;
               }
             }
@@ -508,74 +1784,686 @@ class AsyncTemperatureReader
     }
 
   private:
-    void _readScratchpad(bool isMultidrop, const byte* deviceAddress, byte *scratchPad)
+    // Stops the compiler moving memory accesses across it, so a ring entry is all written
+    // (or all read) before the index that hands it over moves.  A single AVR core needs no more.
+    static inline void compilerBarrier()
+    {
+      __asm__ __volatile__("" ::: "memory");
+    }
+
+    void publish(byte device, byte family, const byte *pad, byte errors)
+    {
+      byte next = ringHead + 1;
+      if (next == ringSize) next = 0;
+      if (next == ringTail) {          // Full.  The main loop has fallen behind: drop this one.
+        if (readingsDropped < 255) readingsDropped++;
+        return;
+      }
+      TemperatureReading *r = &ring[ringHead];
+      r->device = device;
+      r->status = errors;
+      r->family = family;
+      r->count = errors ? 0 : countOf(family, pad[0], pad[1], pad[6], pad[7]);
+      r->at = millis();
+      compilerBarrier();
+      ringHead = next;
+    }
+
+    // A skip-ROM read never saw a ROM ID, so the family has to come from the scratchpad
+    // itself.  Byte 4 is the DS18B20's config register, whose top bit always reads 0; on a
+    // DS1820 / DS18S20 it is reserved and reads 0xFF.  (Single-drop reads always fetch
+    // all 72 bits, so byte 4 is there to look at.)
+    static byte familyOfScratchpad(const byte *pad)
+    {
+      return (pad[4] & 0x80) ? 0x10 : 0x28;
+    }
+
+    // At the end of a read (after any retries): one reading for the device just read, or
+    // one for each lane of the row, into the ring, if there is one.
+    void publishReadings(byte errors)
+    {
+      if (ring == NULL) return;
+      if (numLanes == 1) {
+        publish(deviceIndex, readMultiDrop ? deviceAddr[0] : familyOfScratchpad(inputBuf), inputBuf, errors);
+        return;
+      }
+      byte lane = 0;
+      for (byte m = 1; m != 0; m <<= 1) {
+        if (busPinMask & m) {
+          if (lanesInUse & m) {
+            publish(deviceIndex * numLanes + lane, laneAddr[lane][0], laneBuf[lane], (laneErrors & m) ? errors : 0);
+          }
+          lane++;
+        }
+      }
+    }
+
+    // Zero the buffer(s) of the read in progress: we only store 1 bits.
+    void clearBuffers()
+    {
+      if (numLanes == 1) {
+        memset(inputBuf, 0, 9);
+      }
+      else {
+        for (byte lane = 0; lane < numLanes; lane++) {
+          if (laneBuf[lane] != NULL) memset(laneBuf[lane], 0, 9);
+        }
+      }
+    }
+
+    // Set up the read of row i of the device list: device i on a single-lane reader,
+    // devices i*numLanes .. i*numLanes+numLanes-1, one per lane, on a multi-lane one.
+    // A short last row leaves its spare lanes out.  Returns how many bits to read.
+    byte loadRow(byte i)
     {
+      if (numLanes == 1) {
+        deviceAddr = deviceList[i];
+        inputBuf = scratchPads[i];
+        clearBuffers();
+        return fleetTemperatureOnly ? temperatureBits(deviceAddr[0]) : 72;
+      }
+
+      byte numBits = 0;
+      byte lane = 0;
+      lanesInUse = 0;
+      for (byte m = 1; m != 0; m <<= 1) {
+        if (busPinMask & m) {
+          unsigned int d = (unsigned int) i * numLanes + lane;
+          if (d < numDevices) {
+            laneAddr[lane] = deviceList[d];
+            laneBuf[lane] = scratchPads[d];
+            lanesInUse |= m;
+            byte bits = fleetTemperatureOnly ? temperatureBits(deviceList[d][0]) : 72;
+            if (bits > numBits) numBits = bits;   // The row reads as far as its hungriest device needs.
+          }
+          else {
+            laneAddr[lane] = NULL;
+            laneBuf[lane] = NULL;
+          }
+          lane++;
+        }
+      }
+      clearBuffers();
+      return numBits;
+    }
+
+    // Queued requests.  Every entry point just writes down what it was asked to do, and
+    // submit() puts that in the queue.  Whenever the interpreter runs out of things to do,
+    // it takes the next one off the queue and pushes its program.
+    byte request(byte kind, byte a = 0, byte b = 0, byte c = 0, byte d = 0, unsigned int n = 0,
+                 const void *p = NULL, void *q = NULL)
+    {
+      Request r;
+      r.kind = kind;
+      r.a = a;
+      r.b = b;
+      r.c = c;
+      r.d = d;
+      r.n = n;
+      r.p = p;
+      r.q = q;
       noInterrupts();
+      byte ticket = submit(r);
+      interrupts();
+      return ticket;
+    }
+
+    byte submit(Request &r)
+    { // Pre: interrupts already disabled;
+      if (queueLength >= requestQueueSize) {
+        return NoTicket;          // Full up.  Nothing happens: try again later.
+      }
+      if (++lastTicket == NoTicket) lastTicket++;
+      r.ticket = lastTicket;
+      ticketOf[r.ticket % ticketMemory] = r.ticket;
+      ticketStatus[r.ticket % ticketMemory] = StillBusy;
+      queue[(queueHead + queueLength) % requestQueueSize] = r;
+      queueLength++;
+      if (topOfStack == 0) {      // Nothing running: start it now, so getStatus() sees it straight away.
+        startNextRequest();
+        busScheduler.wake(this);
+      }
+      else {
+        status |= StillBusy;      // Until the queue is empty.
+      }
+      return r.ticket;
+    }
+
+    void startNextRequest()
+    { // Pre: interrupts already disabled, and the queue isn't empty.
+      Request &r = queue[queueHead];
+      queueHead = (queueHead + 1) % requestQueueSize;
+      queueLength--;
+      currentTicket = r.ticket;
+      lanesInUse = busPinMask;    // Unless a read says otherwise, every lane is in play.
+      push(ClearBusyStatus);      // Operations back to front on the stack: the end of every request.
+
+      switch (r.kind) {
+        case DoRead:
+          _readScratchpad(r.a, (const byte *) r.p, (byte *) r.q, r.b);
+          break;
+        case DoReadID:
+          _getUniqueDeviceID((byte *) r.q);
+          break;
+        case DoFind:
+          _findDevices((byte (*)[8]) r.q, r.a, r.b);
+          push(true);             // first pass
+          push(SearchNextDevice);
+          break;
+        case DoReadAlarmed:
+          _readAlarmedScratchpads((byte (*)[8]) r.p, r.a, (byte (*)[9]) r.q, r.b);
+          break;
+        case DoReset:
+          status = StillBusy;
+          push(Reset);
+          break;
+        case DoWrite:
+          if (r.p == NULL) conversionBits = r.c;              // Every device: exactly this resolution.
+          else if (r.c > conversionBits) conversionBits = r.c;
+          _writeScratchpad((const byte *) r.p, r.a, r.b, r.c, r.d);
+          break;
+        case DoProfile:
+          _profileConversions((const byte (*)[8]) r.p, r.a);
+          break;
+        case DoPowerSupply:
+          _readPowerSupply();
+          break;
+        case DoConvertAll:
+          _convertAllTemperatures();
+          break;
+        case DoReadList:
+          _readScratchpads((const byte (*)[8]) r.p, r.a, (byte (*)[9]) r.q, r.b, r.c);
+          break;
+        case DoSample:
+          if (keepSampling) {
+            // NextSample called us, between two cycles of a sampling that's still going, and is
+            // back on the stack already.  The new one takes over that loop rather than starting
+            // another on top of it, so it doesn't need the ClearBusyStatus we just pushed: the
+            // old one's, under NextSample, does for both.  But the old request is over, so say
+            // so now, or its ticket says StillBusy for ever.
+            topOfStack--;
+            ticketStatus[sampling.ticket % ticketMemory] = status & (NoDeviceOnBus | CRCError);
+          }
+          else {
+            push(NextSample);     // Right under ClearBusyStatus, so it's cheap to go round for ever.
+          }
+          sampling = r;
+          _sampleContinuously((const byte (*)[8]) r.p, r.a, (byte (*)[9]) r.q, r.n, r.b);
+          break;
+        case DoTestTimings:
+          _doTestTimings(r.n);
+          break;
+        case DoCalibrate:
+          status = StillBusy;
+          push(calibrationRuns * calibrationYields);
+          push(Calibrate);
+          break;
+      }
+    }
+
+    void _readScratchpad(bool isMultidrop, const byte* deviceAddress, byte *scratchPad, byte numBits)
+    {
       if (isMultidrop) {
         deviceAddr = deviceAddress;
       }
       inputBuf = scratchPad;
       memset(inputBuf, 0, 9); // we only store 1 bits, so this array must be zeroed.
-      flushStack();
+      deviceIndex = 0;
+      retriesLeft = maxRetries;
+      priorErrors = 0;
       status = StillBusy;
-      push(ClearBusyStatus); // Operations back to front on the stack: do this when ReadScratchPad terminates
+      push(numBits);         // how much of the scratchpad we want
       push(isMultidrop);     // set up multi-drop parameter so ReadScratch knows what to do
       push(ReadScratchPad);
-      interrupts();
+    }
+
+    void _getUniqueDeviceID(byte *deviceAddress)
+    {
+      inputBuf = deviceAddress;
+      memset(inputBuf, 0, 8); // we only store 1 bits, so this array must be zeroed.
+      status = StillBusy;
+      pushProgram(ReadRomProgram);
+    }
+
+    void _readAlarmedScratchpads(byte table[][8], byte tableSize, byte buffers[][9], bool temperatureOnly)
+    {
+      _findDevices(table, tableSize, ALARMSEARCH);
+      scratchPads = buffers;
+      fleetTemperatureOnly = temperatureOnly;
+      priorErrors = 0;
+      status = StillBusy | DevicesAreBusy;
+      pushProgram(ConvertAlarmedProgram);
+    }
+
+    void _profileConversions(const byte deviceAddresses[][8], byte n)
+    {
+      deviceList = deviceAddresses;
+      numDevices = n;
+      profileStale = false;
+      status = StillBusy | DevicesAreBusy;
+      push(0);               // Start with the first device in the list.
+      push(ProfileNextDevice);
+    }
+
+    void _readPowerSupply()
+    {
+      parasitePowered = false;
+      status = StillBusy;
+      pushProgram(PowerSupplyProgram);
+    }
+
+    void _convertAllTemperatures()
+    {
+      status = StillBusy | DevicesAreBusy;
+      pushProgram(ConvertAllProgram);
+    }
+
+    void _sampleContinuously(const byte deviceAddresses[][8], byte n, byte buffers[][9], unsigned int periodMillis,
+                             bool temperatureOnly)
+    {
+      useFleet(deviceAddresses, n, buffers, temperatureOnly);
+      samplePeriodMs = periodMillis;
+      sampleCycleAt = millis() - periodMillis;   // The first cycle is due now.
+      keepSampling = true;
+      status = StillBusy;
+    }
+
+    void _doTestTimings(uint16_t repeats)
+    {
+      status = StillBusy;
+      push(BusRelease);
+      push(repeats >> 8);  // HiByte
+      push(repeats & 0xFF); // LoByte
+      push(TestTimings);
     }
 
   public:
 
-    void readScratchpadAsync(const byte* deviceAddress, byte *scratchPad)
+    // Times a few yields against micros(), to see whether they really come out as long as
+    // asked on this build (the compiler, its optimisation level, whatever else is hooked on
+    // interrupts and holds ours up), and redoes this reader's slot timings from that.
+    // It takes the quickest of a few runs, and never takes more than maxCorrectionMicros
+    // off a slot.  It doesn't touch the bus, and takes 4ms or so.  begin(true) does it for you.
+    // Other readers on busScheduler would spoil the measurement, so run it while they are
+    // idle: if they never are, the timings stay as they were, and the ticket gets OtherBusesBusy.
+    byte calibrateTimingsAsync()
+    {
+      return request(DoCalibrate);
+    }
+
+    // What the reader yields for, in tics, for the slot timing Slot55 ... Slot480.
+    byte getSlotTics(byte slot)
+    {
+      byte result;
+      noInterrupts();
+      result = slotTics[slot];
+      interrupts();
+      return result;
+    }
+
+    // What a yield costs on top of the tics it asks for, in us: 0 until we've calibrated.
+    int getOverheadMicros()
+    {
+      int result;
+      noInterrupts();
+      result = overheadMicros;
+      interrupts();
+      return result;
+    }
+
+    // Families differ in which scratchpad bytes getRaw() needs:  0x28 has the whole
+    // temperature in bytes 0-1, our 0x10 parts need the count bytes 6-7 as well.
+    static byte temperatureBits(byte family)
+    {
+      switch (family) {
+        case 0x28: return 16;
+        case 0x10: return 64;
+      }
+      return 72;
+    }
+
+    // Every entry point below that starts something on the bus queues it behind whatever
+    // is running, rather than throwing that away, and returns a ticket.  They run one after
+    // the other, in the order they were asked for, and getTicketStatus(ticket) says how
+    // each one went.  Up to requestQueueSize can wait; if the queue is full, you get
+    // NoTicket and nothing happens.  getStatus() is about the request running now (and
+    // StillBusy stays set until the queue is empty).
+
+    // Reads the whole scratchpad, CRC byte and all.  Or just its first numBits bits:
+    // the device is cut off with a bus reset as soon as we have what we need.  numBits
+    // runs from 1 to 72 (the 9 bytes scratchPad has to hold); anything outside that is
+    // clamped, so 0 still reads one bit and nothing writes past the end of the buffer.
+    byte readScratchpadAsync(const byte* deviceAddress, byte *scratchPad, byte numBits = 72)
+    {
+      static_assert(numLanes == 1, "Single reads need a single-lane reader; use readScratchpadsAsync() on a multi-lane one");
+      if (numBits < 1) numBits = 1;
+      if (numBits > 72) numBits = 72;
+      return request(DoRead, true, numBits, 0, 0, 0, deviceAddress, scratchPad);
+    }
+
+    // Reads only the scratchpad bytes getRaw() needs for this device's family.
+    // Much quicker (16 bits instead of 72 for a DS18B20), but there is no CRC to check.
+    byte readTemperatureAsync(const byte* deviceAddress, byte *scratchPad)
     {
-      _readScratchpad(true, deviceAddress, scratchPad);
+      static_assert(numLanes == 1, "Single reads need a single-lane reader; use readScratchpadsAsync() on a multi-lane one");
+      return request(DoRead, true, temperatureBits(deviceAddress[0]), 0, 0, 0, deviceAddress, scratchPad);
     }
 
     // If we have single-drop bus (i.e. only one device on the bus) there is no need
     // to send the deviceAddress.   DS18B20 datasheet, page 11
-    void readUniqueScratchpadAsync(byte *scratchPad)
+    byte readUniqueScratchpadAsync(byte *scratchPad)
     {
-      _readScratchpad(false, NULL, scratchPad);
+      static_assert(numLanes == 1, "Single reads need a single-lane reader; use readScratchpadsAsync() on a multi-lane one");
+      return request(DoRead, false, 72, 0, 0, 0, NULL, scratchPad);
     }
 
     // If we have a single-drop bus there is a lightweight way to discover its ID
-    void getUniqueDeviceIDAsync(byte * deviceAddress)
+    byte getUniqueDeviceIDAsync(byte * deviceAddress)
+    {
+      static_assert(numLanes == 1, "getUniqueDeviceIDAsync() needs a single-lane reader");
+      return request(DoReadID, 0, 0, 0, 0, 0, NULL, deviceAddress);
+    }
+
+    // Finds the devices on the bus, in the background, and puts their IDs in table:
+    // the same search as SensorDiscovery, without the main loop standing still for it.
+    // StillBusy clears when the search is over, then getNumDevicesFound() says how many
+    // it found.  It stops early if the table fills up.  A device whose ID fails its CRC
+    // sets CRCError and is left out: run the search again.  NoDeviceOnBus means the search
+    // had to be abandoned (or never started) because nobody answered.
+    byte findDevicesAsync(byte table[][8], byte tableSize)
+    {
+      static_assert(numLanes == 1, "The ROM searches need a single-lane reader");
+      return request(DoFind, tableSize, SEARCHROM, 0, 0, 0, NULL, table);
+    }
+
+    // The same, but only the devices in alarm answer ALARMSEARCH: those whose last conversion
+    // came out (in whole degrees) at or above their TH, or at or below their TL.  So call
+    // it once convertAllTemperaturesAsync() is done.  Nobody in alarm finds 0 devices, and
+    // is not an error.
+    byte findAlarmedDevicesAsync(byte table[][8], byte tableSize)
+    {
+      static_assert(numLanes == 1, "The ROM searches need a single-lane reader");
+      return request(DoFind, tableSize, ALARMSEARCH, 0, 0, 0, NULL, table);
+    }
+
+    // The whole over-temperature check as one background program: convert all temperatures,
+    // wait for the conversions, find the devices in alarm, and read just their scratchpads,
+    // into buffers[0 .. getNumDevicesFound()-1].  DevicesAreBusy clears when the conversions
+    // are done, StillBusy when the last scratchpad is in.
+    byte readAlarmedScratchpadsAsync(byte table[][8], byte tableSize, byte buffers[][9], bool temperatureOnly = false)
     {
+      static_assert(numLanes == 1, "The ROM searches need a single-lane reader");
+      return request(DoReadAlarmed, tableSize, temperatureOnly, 0, 0, 0, table, buffers);
+    }
+
+    byte getNumDevicesFound()
+    {
+      byte result;
       noInterrupts();
-      inputBuf = deviceAddress;
-      memset(inputBuf, 0, 8); // we only store 1 bits, so this array must be zeroed.
-      flushStack();
-      status = StillBusy;
-      push(ClearBusyStatus); // Operations back to front on the stack: do this when ReadScratchPad terminates
-      push(64);  // total number of bits we want to read
-      push(0);   // and the index to put the next bit in the buffer
-      push(ReadRemainingBits);
-      pushSendOneByte(READROM);
-      push(Reset);
+      result = numFound;
       interrupts();
+      return result;
+    }
+
+    byte resetAsync()
+    {
+      return request(DoReset);
     }
 
-    void resetAsync()
+    // Sets the alarm thresholds TH and TL (whole degrees) of one device and, if it is a
+    // DS18B20, its resolution: 9 to 12 bits, 94 to 750ms per conversion (anything outside
+    // that is clamped to it).  With saveToEeprom the device keeps them through a power
+    // cycle (COPYSCRATCH, about 10ms more).
+    // Conversion waits are sized for the finest resolution any device was set to, so lowering
+    // one device's resolution doesn't shorten them: set them all at once for that.
+    byte writeScratchpadAsync(const byte *deviceAddress, int8_t th, int8_t tl, byte resolution = 12, bool saveToEeprom = false)
+    {
+      static_assert(numLanes == 1, "Single writes need a single-lane reader; use writeAllScratchpadsAsync() on a multi-lane one");
+      return request(DoWrite, th, tl, validResolution(resolution), saveToEeprom, 0, deviceAddress);
+    }
+
+    // The same for every device on the bus at once (SKIP ROM), and conversion waits get
+    // sized for exactly this resolution.  That's where the speed-up is: at 9 bits, eight
+    // conversions in the time of one 12-bit one.  DS1820s (family 0x10) just take TH and TL,
+    // and still need up to 750ms, so leave the resolution at 12 on a bus that has them.
+    byte writeAllScratchpadsAsync(int8_t th, int8_t tl, byte resolution = 12, bool saveToEeprom = false)
+    {
+      return request(DoWrite, th, tl, validResolution(resolution), saveToEeprom);
+    }
+
+    // After STARTCONVO we ask the devices whether they're done with a read slot every
+    // pollInterval TIMER2 tics (2us each at 16MHz), so the readings can start as soon as the
+    // slowest device is done.  The default is about 1ms.  Shorter finds out sooner, at the
+    // cost of more timeslices.  0 turns polling off, for devices that don't answer read
+    // slots while converting: then we wait as long as the datasheet says for the resolution.
+    // Anything over longestHoldoff (32767 tics, 65ms at 16MHz) is taken as longestHoldoff:
+    // the scheduler can't tell a deadline further off than that from one that's overdue.
+    void setPollInterval(unsigned int tics)
     {
       noInterrupts();
-      flushStack();
-      status = StillBusy;
-      push(ClearBusyStatus);  // Do this when Reset terminates
-      push(Reset);
+      pollInterval = tics > longestHoldoff ? longestHoldoff : tics;
+      interrupts();
+    }
+
+    unsigned int getPollInterval()
+    {
+      return pollInterval;
+    }
+
+    // How many bit slots a timeslice does, one after the other with _delay_us() in between,
+    // when sending and reading bytes.  1 (the default) yields after every slot, so nothing
+    // else waits on us for more than about 15us.  More saves getting in and out of the ISR
+    // for every bit, which is most of what a slot costs the CPU, but each timeslice busy-waits
+    // for up to (k - 1) x 70us, and everything else waits for it.  That includes the other
+    // buses on busScheduler: a write-0 slot that waits behind a few of those turns into a
+    // reset.  So it's for a bus that has TIMER2 to itself: whenever another reader has work,
+    // our timeslices go back to one slot each until it's idle again.  Up to maxSlotsPerSlice.
+    void setSlotsPerSlice(byte k)
+    {
+      if (k < 1) k = 1;
+      if (k > maxSlotsPerSlice) k = maxSlotsPerSlice;
+      noInterrupts();
+      slotsPerSlice = k;
+      interrupts();
+    }
+
+    // How long we expect conversions on this bus to take, in ms.  We learn it as we go, so
+    // you only need this to start with a good guess, or with 0 (no idea, poll from the start)
+    // after swapping the devices for quicker ones.  We never expect more than the datasheet
+    // time for the resolution.
+    void setExpectedConversionMillis(unsigned int ms)
+    {
+      noInterrupts();
+      learnedConversionMs = ms;
+      interrupts();
+    }
+
+    unsigned int getExpectedConversionMillis()
+    {
+      unsigned int result;
+      noInterrupts();
+      result = learnedConversionMs;
+      interrupts();
+      return result;
+    }
+
+    // Conversion times per device.  Supply one unsigned int per device in the list you give
+    // profileConversionsAsync() and readAllScratchpadsAsync() (the same list), zeroed to start
+    // with.  profileConversionsAsync() times a conversion of each device on its own, and keeps a
+    // moving average, in ms, in msPerDevice[i].  From then on, readAllScratchpadsAsync() sleeps
+    // until the slowest device in its list should nearly be done, rather than going by the bus
+    // as a whole or by the datasheet.  (It still polls before reading, and all the devices on
+    // the bus convert, so one that's not in the list but slower still holds things up.)
+    // If they turn out quicker than their profile, it's put aside until you profile again.
+    void setConversionProfile(unsigned int *msPerDevice)
+    {
+      noInterrupts();
+      conversionProfile = msPerDevice;
+      profileStale = false;
+      interrupts();
+    }
+
+    // Takes n conversions, one after the other, so it's slow: at boot, or now and again.
+    // On a parasitically powered bus it does nothing: they can't be polled.  Nor with polling
+    // turned off (setPollInterval(0)): every conversion then takes the datasheet time anyway.
+    byte profileConversionsAsync(const byte deviceAddresses[][8], byte n)
+    {
+      static_assert(numLanes == 1, "profileConversionsAsync() needs a single-lane reader");
+      return request(DoProfile, n, 0, 0, 0, 0, deviceAddresses);
+    }
+
+    // Asks the devices whether any of them is parasitically powered, i.e. hangs on just the
+    // data line and ground.  Do it once at startup, after begin(), and again if you change
+    // the devices.  StillBusy clears when we know, and isParasitePowered() says.  From then
+    // on every conversion and every save to EEPROM gets the line driven hard high for the
+    // datasheet time (sized for the resolution), instead of being polled.  One parasitic
+    // device is enough: the externally powered ones don't mind.
+    byte readPowerSupplyAsync()
+    {
+      return request(DoPowerSupply);
+    }
+
+    bool isParasitePowered()
+    {
+      bool result;
+      noInterrupts();
+      result = parasitePowered;
+      interrupts();
+      return result;
+    }
+
+    byte convertAllTemperaturesAsync() {
+      return request(DoConvertAll);
+    }
+
+    // Convert all temperatures, then read every device in the list into its own
+    // scratchpad buffer, all as one background program: no main-loop round trips
+    // between the steps.  DevicesAreBusy clears when the conversions are done,
+    // StillBusy when the last scratchpad is in.  With temperatureOnly, each read
+    // stops at the bytes getRaw() needs, as readTemperatureAsync() does.
+    //
+    // On a multi-lane reader the list is read numLanes devices at a time: device d
+    // must sit on lane d % numLanes, i.e. the (d % numLanes)'th bit of busPinMask.
+    byte readAllScratchpadsAsync(const byte deviceAddresses[][8], byte n, byte buffers[][9], bool temperatureOnly = false)
+    {
+      return request(DoReadList, n, temperatureOnly, true, 0, 0, deviceAddresses, buffers);
+    }
+
+    // Free running: readAllScratchpadsAsync() every periodMillis, for ever, with no help from
+    // the main loop.  Set up a ring with setReadingRing() first, and take the readings out
+    // whenever you like; the buffers always hold the latest scratchpads too.  A cycle that
+    // takes longer than the period is followed straight away by the next one (so 0 means
+    // flat out).  StillBusy stays set the whole time, DevicesAreBusy is set while the
+    // devices convert, and the error bits are those of the cycle in progress.
+    // Requests queued behind it get their turn between cycles.
+    // stopSampling() lets the cycle in progress finish, then StillBusy clears.
+    byte sampleContinuouslyAsync(const byte deviceAddresses[][8], byte n, byte buffers[][9], unsigned int periodMillis,
+                                 bool temperatureOnly = false)
+    {
+      return request(DoSample, n, temperatureOnly, 0, 0, periodMillis, deviceAddresses, buffers);
+    }
+
+    void stopSampling()
+    {
+      noInterrupts();
+      keepSampling = false;
+      interrupts();
+    }
+
+    // As readAllScratchpadsAsync(), but with no conversion first: just read the list.
+    byte readScratchpadsAsync(const byte deviceAddresses[][8], byte n, byte buffers[][9], bool temperatureOnly = false)
+    {
+      return request(DoReadList, n, temperatureOnly, false, 0, 0, deviceAddresses, buffers);
+    }
+
+    // How the request with this ticket went: StillBusy while it waits or runs, then its
+    // error bits (0 if all went well).  The last ticketMemory tickets are remembered; for
+    // older ones (or NoTicket, or ones cancelled) the answer is NoResult.
+    byte getTicketStatus(byte ticket)
+    {
+      byte result = NoResult;
+      noInterrupts();
+      if (ticket != NoTicket && ticketOf[ticket % ticketMemory] == ticket) {
+        result = ticketStatus[ticket % ticketMemory];
+      }
       interrupts();
+      return result;
     }
 
-    void convertAllTemperaturesAsync() {
+    // The old behaviour, when you really want it: drop whatever is running and everything
+    // queued, and let go of the bus.  Their tickets say NoResult.
+    void cancelAll()
+    {
       noInterrupts();
       flushStack();
-      status =  DevicesAreBusy;
-      push(WaitForBusRelease);
-      pushSendOneByte(STARTCONVO);
-      pushSendOneByte(SKIPROMWILDCARD);
-      push(Reset);
+      BusPort::endPullHigh(busPinMask);   // Released, whatever it was doing (even a strong pull-up).
+      queueLength = 0;
+      keepSampling = false;
+      for (byte i = 0; i < ticketMemory; i++) {
+        if (ticketStatus[i] == StillBusy) ticketStatus[i] = NoResult;
+      }
+      status = 0;
       interrupts();
     }
 
+  private:
+    void _writeScratchpad(const byte *deviceAddress, int8_t th, int8_t tl, byte resolution, bool saveToEeprom)
+    {
+      deviceAddr = deviceAddress;
+      writeBuf[0] = th;
+      writeBuf[1] = tl;
+      writeBuf[2] = ((resolution - 9) << 5) | 0x1F;   // Config register: R1 R0 in bits 6 and 5, the rest reads as 1s.
+      writeLen = (deviceAddress != NULL && deviceAddress[0] == 0x10) ? 2 : 3;   // 0x10 has no config register
+      status = StillBusy;
+      if (saveToEeprom) {
+        push(CopyScratchPad);
+      }
+      push(0);
+      push(SendWriteBytes);
+      pushSendOneByte(WRITESCRATCH);
+      if (deviceAddress != NULL) {
+        push(StartIDSend);
+      }
+      else {
+        pushSendOneByte(SKIPROMWILDCARD);
+      }
+      push(Reset);
+    }
+
+    void _findDevices(byte table[][8], byte tableSize, byte command)
+    {
+      searchTable = table;
+      searchTableSize = tableSize;
+      searchCommand = command;
+      numFound = 0;
+      status = StillBusy;
+    }
+
+    void useFleet(const byte deviceAddresses[][8], byte n, byte buffers[][9], bool temperatureOnly)
+    {
+      deviceList = deviceAddresses;
+      scratchPads = buffers;
+      numDevices = n;
+      fleetTemperatureOnly = temperatureOnly;
+      priorErrors = 0;
+    }
+
+    void _readScratchpads(const byte deviceAddresses[][8], byte n, byte buffers[][9], bool temperatureOnly, bool convertFirst)
+    {
+      useFleet(deviceAddresses, n, buffers, temperatureOnly);
+      status = StillBusy;
+      if (convertFirst) {
+        status |= DevicesAreBusy;
+        pushProgram(ConvertListProgram);
+      }
+      else {
+        push(0);             // Start with the first device (or row of devices) in the list.
+        push(ReadNextScratchPad);
+      }
+    }
+
+  public:
+
     int getRaw(byte * deviceAddress, byte * scratchPad)
     {
       byte lsb, msb, b6, b7;
@@ -585,9 +2473,32 @@ class AsyncTemperatureReader
       b6 = scratchPad[6];
       b7 = scratchPad[7];
       interrupts();
+      return decodeRaw(deviceAddress[0], lsb, msb, b6, b7);
+    }
+
+    // As getRaw(), for a reading out of the ring.
+    static int getRaw(const TemperatureReading &reading)
+    {
+      return rawOfCount(reading.family, reading.count);
+    }
+
+    static float getTempC(const TemperatureReading &reading)
+    {
+      float raw = getRaw(reading);
+      return (raw / 128.0);
+    }
+
+    // Interpret the raw values on the basis of the type of sensor.
+    static int decodeRaw(byte family, byte lsb, byte msb, byte b6, byte b7)
+    {
+      return rawOfCount(family, countOf(family, lsb, msb, b6, b7));
+    }
 
-      // Now interpret the raw values on the basis of the type of sensor
-      switch (deviceAddress[0]) {
+    // The scratchpad's temperature bytes as one count, in whatever units the family counts
+    // in.  Integer shifts only, so the ISR can do it.
+    static int countOf(byte family, byte lsb, byte msb, byte b6, byte b7)
+    {
+      switch (family) {
 
         case 0x28: {
             int16_t raw = (((int16_t) msb) << 11) | (((int16_t) lsb) << 3);
@@ -612,9 +2523,23 @@ class AsyncTemperatureReader
 
             raw = (raw << 3)    // make space for 16th's
                   + (b7 - b6);  // and add the four bits (sixteenths) from the leftovers
+            return raw;
+          }
+      }
+      return 0xFFFF;  // To mean "we have no idea"
+    }
 
-            // These are now in 16'ths of a degree. Change them to 128ths. Wait for better hardware with more sub-degree resoluation.
-            int16_t x  = raw << 3;
+    // A count from countOf() in 128ths of a degree, as getRaw() gives it.
+    static int rawOfCount(byte family, int16_t count)
+    {
+      switch (family) {
+
+        case 0x28:
+          return count;
+
+        case 0x10: {
+            // These are in 16'ths of a degree. Change them to 128ths. Wait for better hardware with more sub-degree resoluation.
+            int16_t x  = count << 3;
 
             // Linear remapping calculated from (x0,y0) and (x1, y1) measurements at about 22 degrees and 60 degrees.  f(x) = a + bx
             // I don't have a good reference themometer, so these numbers might be off by some margin.  Let me know if you can measure accurately.
@@ -634,18 +2559,60 @@ class AsyncTemperatureReader
       return (raw / 128.0);
     }
 
-    void doTestTimings(uint16_t repeats)
+    byte doTestTimings(uint16_t repeats)
+    {
+      return request(DoTestTimings, 0, 0, 0, 0, repeats);
+    }
+
+    // A scratchpad read that fails (no presence pulse, or a bad CRC) is retried by the
+    // interpreter itself, up to maxRetries times, before its error is reported.
+    // If you supply retryCountsPerDevice (one byte per device in the list given to
+    // readAllScratchpadsAsync(), or just one for single reads), each retry is counted
+    // there, so you can see which devices, and so which cable runs, give trouble.
+    // The counts are never cleared by the reader.
+    void setRetries(byte retries, byte *retryCountsPerDevice = NULL)
     {
       noInterrupts();
-      flushStack();
-      status = StillBusy;
-      push(ClearBusyStatus);
-      push(BusRelease);
-      push(repeats >> 8);  // HiByte
-      push(repeats & 0xFF); // LoByte
+      maxRetries = retries;
+      retryCounts = retryCountsPerDevice;
+      interrupts();
+    }
 
-      push(TestTimings);
+    // Every scratchpad read that finishes (after its retries, if any) also goes into this
+    // ring, as a TemperatureReading, for the main loop to take out with nextReading() when
+    // it gets round to it.  No interrupts turned off, and a new read doesn't overwrite
+    // the last one.  A ring of size n holds n - 1 readings.  If the main loop lets it
+    // fill up, later readings are dropped, and counted: see getReadingsDropped().
+    // NULL turns it off.  (The scratchpad buffers still get filled in, as ever.)  So does
+    // a size less than 2, which has no room for anything.  True if the ring is on.
+    bool setReadingRing(TemperatureReading *readings, byte size)
+    {
+      if (size < 2) readings = NULL;
+      noInterrupts();
+      ring = readings;
+      ringSize = size;
+      ringHead = ringTail = 0;
+      readingsDropped = 0;
       interrupts();
+      return readings != NULL;
+    }
+
+    // The main loop's end of the ring.  False if there's nothing new.
+    bool nextReading(TemperatureReading &reading)
+    {
+      byte tail = ringTail;
+      if (tail == ringHead) return false;
+      compilerBarrier();                 // Don't look at the entry before we know it's there.
+      reading = ring[tail];
+      compilerBarrier();                 // Done with it before we hand the slot back.
+      if (++tail == ringSize) tail = 0;
+      ringTail = tail;
+      return true;
+    }
+
+    byte getReadingsDropped()
+    {
+      return readingsDropped;
     }
 
     byte getStatus()
@@ -657,26 +2624,29 @@ class AsyncTemperatureReader
       return result;
     }
 
-    void begin()
+    // With calibrate, begin() waits for calibrateTimingsAsync() to finish before it returns.
+    void begin(bool calibrate = false)
     {
       // Initial setup of the timer, etc.
 
       noInterrupts();   //stop interrupts
       pinMode(debugPin, OUTPUT);
       flushStack();
+      conversionBits = 12;          // The power-on resolution, until we're told otherwise.
+      pollInterval = Micros1000;
+      slotsPerSlice = 1;
+      memcpy(slotTics, defaultSlotTics, numSlotTimings);
+      overheadMicros = 0;
 
-      // https://www.instructables.com/id/Arduino-Timer-Interrupts/
-      // Page references refer to  https://www.sparkfun.com/datasheets/Components/SMD/ATMega328.pdf
-      TCCR2A = 0;                   // set entire TCCR2A register to 0  pg158
-      TCCR2B = 0;                   // same for TCCR2B
-      TCCR2A |= (1 << WGM21);       // turn on CTC mode
-      TIMSK2 |= (1 << OCIE2A);      // enable timer compare interrupt
-
-      OCR2A = 255;  // set our first interrupt event to occur as far into the future possile
-      TCNT2  = 0;   //initialize counter value to 0
-      TCCR2B |= (1 << CS22);  // pg 162./ Pg188  Attach timer to prescaler source. This starts the timer
+      busScheduler.add(this);       // Every reader gets its timeslices from the one TIMER2,
+      busScheduler.startTimer();    // which only needs setting up by the first of them.
 
       interrupts();   //allow interrupts
+
+      if (calibrate) {
+        calibrateTimingsAsync();
+        busyWait("calibrateTimingsAsync", 20);
+      }
     }
 
     // Wait for the status bits we are interested in to all be zero. (status & mask).
@@ -699,7 +2669,10 @@ class AsyncTemperatureReader
 
 };
 
-AsyncTemperatureReader myTemperatureSensors;   // A single instance of the class manages one wire.
+AsyncTemperatureReader<PortB, 0b00010000> myTemperatureSensors;   // Each instance of the class manages one wire.
+// More buses are just more instances, each on its own pin, e.g.
+//    AsyncTemperatureReader<PortD, 0b00000100> outsideSensors;   // UNO pin 2
+// Call begin() on each of them and they share TIMER2 through busScheduler.
 
 // Diagnostic, keeps track of the longest interval in the ISR.
 // Can be read and zerod in main program within a critical section.
@@ -709,10 +2682,8 @@ long ISR_max_busytime = 0;
 ISR(TIMER2_COMPA_vect) {
   //  long t0 =  micros();                          // diagnostic
 
-  TCCR2B = 0;                                   // pg 162. Stop the timer
-  OCR2A = myTemperatureSensors.doTimeslice();  // Do a timeslice, and collect the next required delay
-  TCNT2 = 0;                                    // re-start the counter again from zero
-  TCCR2B |= (1 << CS22);                        // pg 162.  Mega=pg188 Set prescaler, Start the timer
+  busScheduler.doTimeslices();   // Timeslices for whichever buses are due, and OCR2A moved on to the next deadline.
+                                 // TIMER2 keeps counting throughout: nothing we do in here adds to anybody's wait.
 
   //  long et = micros() - t0;   // diagnostic
   // if (et > ISR_max_busytime) ISR_max_busytime = et;
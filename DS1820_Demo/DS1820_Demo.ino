@@ -21,6 +21,7 @@ DeviceAddress device[] =
 
 typedef byte ScratchPad[9];
 ScratchPad sPad;
+ScratchPad sPads[2];   // One per device, for readAllScratchpadsAsync()
 
 #ifdef CompareAgainstDallasLib
 
@@ -45,11 +46,17 @@ void setup(void) {
 #endif
 
   myTemperatureSensors.begin();
+
+  // Two-wire (parasitic) probes need a strong pull-up while they convert.  Ask once.
+  myTemperatureSensors.readPowerSupplyAsync();
+  myTemperatureSensors.busyWait("readPowerSupplyAsync", 10);
+  if (myTemperatureSensors.isParasitePowered()) Serial.println("Parasitic power on the bus");
 }
 
 const int None = 0;
 const int Async = 1;
 const int Dallas = 2;
+const int AsyncAll = 3;
 
 
 void loop(void) {
@@ -60,6 +67,7 @@ void loop(void) {
 
   senseAndCountFreeTime(None);      // Don't use any sensing, we'll get an idea of raw loop speed
   senseAndCountFreeTime(Async);     // Use the Async lib, and see how many times we get around the loop
+  senseAndCountFreeTime(AsyncAll);  // The same, but as one background scan of all the devices
 
   delay(20000);
 }
@@ -139,6 +147,26 @@ void senseAndCountFreeTime(int sensingToUse) {
         }
         break;
 
+      case AsyncAll: { // convert and read every device in one background program
+          switch (asyncState) {
+            case 0:
+              myTemperatureSensors.readAllScratchpadsAsync(device, numDevices, sPads);
+              asyncState = 1;
+              break;
+            case 1:
+              if (myTemperatureSensors.getStatus() == 0) { // all the scratchpads are in
+                for (int i = 0; i < numDevices; i++) {
+                  printStuff(" AsyncAll    ", device[i], sPads[i]);
+                }
+                asyncState = 2;
+              }
+              break;
+            case 2: // nothing else to do
+              break;
+          }
+        }
+        break;
+
 #ifdef CompareAgainstDallasLib
       case Dallas: {
           // Use dallas lib
@@ -179,6 +207,10 @@ void senseAndCountFreeTime(int sensingToUse) {
         Serial.print("Using Dallas lib: realWorkCount execution count = "); Serial.println(realWorkCount);
       }
       break;
+    case AsyncAll: {
+        Serial.print("Using Async scan: realWorkCount execution count = "); Serial.println(realWorkCount);
+      }
+      break;
   }
   Serial.println();
 }
@@ -0,0 +1,603 @@
+#pragma once
+
+// A host-side (Linux) backend for AsyncTemperatures.h, so the interpreter can be run
+// and timed on a build server without an Arduino or any sensors.
+//
+// The interpreter only ever touches the outside world through the AVR port registers
+// (DDRx, PORTx, PINx), the TIMER2 registers and its ISR, and a few Arduino calls.
+// When ARDUINO is not defined, this file supplies stand-ins for all of those:
+//
+//  - Simulated ports B, C and D.  Each port bit is an open-drain 1-wire line with a
+//    pull-up.  The line is low if the master drives it low, or if any attached slave
+//    holds it low.  Slaves are added with simPortB.wire[4].attach(...), and so on.
+//  - A simulated TIMER2 (CTC or normal mode, all seven prescalers) that fires the
+//    TIMER2_COMPA_vect ISR at the right moment in virtual time.
+//  - A virtual clock.  _delay_us(), delay(), micros() and millis() all work in
+//    virtual time.  Waiting with interrupts enabled lets the TIMER2 ISR fire,
+//    exactly as it would on the real hardware.
+//
+// Each wire keeps a timing log that classifies every low pulse the master makes and
+// records any pulse, slot or sample time that falls outside the 1-wire spec.
+// TIMER2 counts its interrupts, i.e. the number of timeslices the interpreter got.
+//
+// Nothing in here is real-time: main-loop code must let virtual time pass
+// (delay(), delayMicroseconds(), or simRunFor()) or it will spin forever.
+//
+// Build a host program with something like
+//     g++ -std=c++11 -I DS1820_Demo myprogram.cpp
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// ---------------- Virtual time and interrupt state
+
+uint64_t simNowNs = 0;                // The virtual clock, in nanoseconds.
+bool simInterruptsEnabled = true;
+bool simInIsr = false;
+
+// Fixed cost charged on every ISR entry: the prologue, the dispatch in the ISR and in
+// doTimeslice(), and the bookkeeping pushes.  The scope measurements in README.md
+// (11 tics at /64 gave a 72us pulse instead of 48us) put that at about 24us on a UNO,
+// i.e. 384 clock cycles, which take twice as long at 8MHz.
+uint64_t simIsrOverheadNs = 384 * 1000000000ULL / F_CPU;
+
+void simRun(uint64_t untilNs);   // Lets virtual time pass, firing any interrupts that fall due.
+
+inline void simRunFor(uint64_t ns)
+{
+  simRun(simNowNs + ns);
+}
+
+inline void _delay_us(double us)
+{
+  uint64_t ns = (uint64_t) (us * 1000.0 + 0.5);
+  if (simInIsr || !simInterruptsEnabled) {
+    simNowNs += ns;    // Busy-waiting with interrupts off: nothing else can happen.
+  }
+  else {
+    simRunFor(ns);
+  }
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  _delay_us(us);
+}
+
+inline void delay(unsigned long ms)
+{
+  _delay_us(ms * 1000.0);
+}
+
+inline unsigned long micros()
+{
+  return (unsigned long) (simNowNs / 1000);
+}
+
+inline unsigned long millis()
+{
+  return (unsigned long) (simNowNs / 1000000);
+}
+
+void simServiceInterrupts();
+
+inline void noInterrupts()
+{
+  simInterruptsEnabled = false;
+}
+
+inline void interrupts()
+{
+  simInterruptsEnabled = true;
+  simServiceInterrupts();   // Anything that fell due while interrupts were off fires now.
+}
+
+// Flash: on the host it's just more memory.
+#define PROGMEM
+#define pgm_read_byte(p) (*(const byte *) (p))
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+
+
+// ---------------- Serial, printing to stdout
+
+class SimulatedSerial
+{
+    void printNumber(unsigned long n, int base)
+    {
+      char buf[8 * sizeof(long) + 1];
+      char *p = &buf[sizeof(buf) - 1];
+      *p = 0;
+      do {
+        byte digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+      } while (n);
+      fputs(p, stdout);
+    }
+
+  public:
+    void begin(unsigned long) {}
+
+    void print(const char *s) { fputs(s, stdout); }
+    void print(char c) { putchar(c); }
+    void print(unsigned char n, int base = DEC) { printNumber(n, base); }
+    void print(unsigned int n, int base = DEC) { printNumber(n, base); }
+    void print(unsigned long n, int base = DEC) { printNumber(n, base); }
+    void print(int n, int base = DEC) { print((long) n, base); }
+    void print(long n, int base = DEC)
+    {
+      if (base == DEC && n < 0) {
+        putchar('-');
+        n = -n;
+      }
+      printNumber((unsigned long) n, base);
+    }
+    void print(double d, int digits = 2) { printf("%.*f", digits, d); }
+
+    void println() { putchar('\n'); }
+    template <class T> void println(T x) { print(x); println(); }
+    template <class T> void println(T x, int fmt) { print(x, fmt); println(); }
+};
+
+SimulatedSerial Serial;
+
+
+// ---------------- Registers
+
+// Stands in for one 8-bit I/O register.  Reads and writes are routed to the
+// simulated peripheral that owns the register.
+class SimulatedRegister
+{
+    void *owner;
+    byte (*reader)(void *owner);
+    void (*writer)(void *owner, byte value);
+    byte (*maskedReader)(void *owner, byte mask);
+
+  public:
+    SimulatedRegister(void *theOwner, byte (*r)(void *), void (*w)(void *, byte),
+                      byte (*m)(void *, byte) = NULL)
+      : owner(theOwner), reader(r), writer(w), maskedReader(m) {}
+
+    operator byte() const { return reader(owner); }
+
+    // PINx & mask.  On the real chip reading PINx latches every pin at once, which is harmless,
+    // but here a read is what the wire logs as the master sampling it.  With several buses on
+    // one port, only the buses in the mask should see their slot sampled.
+    byte operator&(byte mask) const { return maskedReader ? maskedReader(owner, mask) : (byte) (reader(owner) & mask); }
+
+    SimulatedRegister &operator=(byte v) { writer(owner, v); return *this; }
+    SimulatedRegister &operator=(const SimulatedRegister &r) { return *this = (byte) r; }
+    SimulatedRegister &operator|=(byte v) { return *this = (byte) (reader(owner) | v); }
+    SimulatedRegister &operator&=(byte v) { return *this = (byte) (reader(owner) & v); }
+    SimulatedRegister &operator^=(byte v) { return *this = (byte) (reader(owner) ^ v); }
+};
+
+
+// ---------------- The 1-wire line
+
+// A device hanging off a simulated wire.  Times are virtual, in nanoseconds.
+class SimulatedSlave
+{
+  public:
+    virtual ~SimulatedSlave() {}
+    virtual void masterPulledLow(uint64_t t) = 0;               // A falling edge from the master.
+    virtual void masterReleased(uint64_t t, uint64_t lowNs) = 0; // The master let go after lowNs.
+    virtual bool holdsLow(uint64_t t) = 0;                      // Is this slave pulling the line low at t?
+    virtual void masterDrive(uint64_t /*t*/, byte /*drive*/) {} // Any change in what the master does, for parasitic power.
+};
+
+const byte MasterReleased = 0;   // High impedance, the pull-up wins unless a slave pulls low.
+const byte MasterLow = 1;
+const byte MasterHigh = 2;       // Output high: a strong pull-up.
+
+// 1-wire standard speed limits, from http://ww1.microchip.com/downloads/en/appnotes/01199a.pdf
+// and the DS18B20 datasheet.
+const uint64_t SpecMinLowNs = 1000;          // tLOW1 min
+const uint64_t SpecMaxShortLowNs = 15000;    // tLOW1 / read-slot low max
+const uint64_t SpecMinWriteZeroNs = 60000;   // tLOW0 min
+const uint64_t SpecMaxWriteZeroNs = 120000;  // tLOW0 max: 120us and up is a reset, as far as the slaves go
+const uint64_t SpecMinResetNs = 480000;      // tRSTL min
+const uint64_t SpecMinRecoveryNs = 1000;     // tREC min
+const uint64_t SpecMinSlotNs = 60000;        // tSLOT min
+const uint64_t SpecMinResetHighNs = 480000;  // tRSTH min
+const uint64_t SpecMaxReadSampleNs = 15000;  // tRDV: master must sample within 15us of the falling edge
+
+class SimulatedWire
+{
+    std::vector<SimulatedSlave *> slaves;
+    byte drive;
+    uint64_t fellAt;          // Last master falling edge
+    uint64_t releasedAt;      // Last master release
+    byte lastPulseKind;
+    bool slotSampled;
+
+    static const byte NoPulse = 0, ShortPulse = 1, WriteZeroPulse = 2, ResetPulse = 3;
+
+    void violation(const char *msg)
+    {
+      violations++;
+      lastViolation = msg;
+      lastViolationAt = simNowNs;
+      if (reportViolations || getenv("SIMV")) {
+        printf("[%10.1fus] 1-wire timing: %s\n", simNowNs / 1000.0, msg);
+      }
+    }
+
+  public:
+    // The timing log
+    unsigned long resetPulses;
+    unsigned long writeZeroSlots;
+    unsigned long shortSlots;      // Write-1 and read slots look the same from the wire.
+    unsigned long samples;
+    unsigned long violations;
+    const char *lastViolation;
+    uint64_t lastViolationAt;
+    bool reportViolations;         // Print each violation as it happens
+
+    // A noisy cable: the chance that a bit the master reads in a read slot arrives flipped.
+    double noiseRate;
+    uint64_t noiseSeed;
+    unsigned long flippedBits;
+
+    SimulatedWire() : drive(MasterReleased), fellAt(0), releasedAt(0), lastPulseKind(NoPulse),
+      slotSampled(false), reportViolations(false), noiseRate(0), noiseSeed(1), flippedBits(0)
+    {
+      clearLog();
+    }
+
+    void clearLog()
+    {
+      resetPulses = writeZeroSlots = shortSlots = samples = violations = 0;
+      lastViolation = "none";
+      lastViolationAt = 0;
+    }
+
+    void attach(SimulatedSlave *s) { slaves.push_back(s); }
+    void detachAll() { slaves.clear(); }
+    size_t slaveCount() const { return slaves.size(); }
+
+    byte masterDrive() const { return drive; }
+
+    void setMasterDrive(byte newDrive)
+    {
+      if (newDrive == drive) return;
+      uint64_t t = simNowNs;
+
+      if (newDrive == MasterLow) {
+        if (lastPulseKind != NoPulse) {
+          if (t - releasedAt < SpecMinRecoveryNs) violation("recovery time between pulses under 1us");
+          if (lastPulseKind == ResetPulse) {
+            if (t - releasedAt < SpecMinResetHighNs) violation("next pulse less than 480us after reset");
+          }
+          else if (t - fellAt < SpecMinSlotNs) {
+            violation("time slot shorter than 60us");
+          }
+        }
+        drive = newDrive;
+        fellAt = t;
+        slotSampled = false;
+        for (size_t i = 0; i < slaves.size(); i++) slaves[i]->masterPulledLow(t);
+      }
+      else if (drive == MasterLow) {
+        uint64_t lowNs = t - fellAt;
+        if (lowNs < SpecMinLowNs) {
+          violation("low pulse shorter than 1us");
+          lastPulseKind = ShortPulse;
+        }
+        else if (lowNs <= SpecMaxShortLowNs) {
+          shortSlots++;
+          lastPulseKind = ShortPulse;
+        }
+        else if (lowNs < SpecMinWriteZeroNs) {
+          violation("low pulse between 15us and 60us is neither a 1 nor a 0");
+          lastPulseKind = WriteZeroPulse;
+        }
+        else if (lowNs < SpecMaxWriteZeroNs) {
+          writeZeroSlots++;
+          lastPulseKind = WriteZeroPulse;
+        }
+        else {
+          if (lowNs < SpecMinResetNs) violation("reset pulse shorter than 480us");
+          resetPulses++;
+          lastPulseKind = ResetPulse;
+        }
+        drive = newDrive;
+        releasedAt = t;
+        for (size_t i = 0; i < slaves.size(); i++) slaves[i]->masterReleased(t, lowNs);
+      }
+      else {
+        drive = newDrive;
+      }
+      for (size_t i = 0; i < slaves.size(); i++) slaves[i]->masterDrive(t, drive);
+    }
+
+    bool level()
+    {
+      if (drive == MasterLow) return false;
+      bool anyLow = false;
+      for (size_t i = 0; i < slaves.size(); i++) {
+        if (slaves[i]->holdsLow(simNowNs)) anyLow = true;
+      }
+      if (drive == MasterHigh) {
+        if (anyLow) violation("master driving high while a slave pulls low");
+        return true;
+      }
+      return !anyLow;
+    }
+
+    // The master read the line.  Only samples taken inside a read slot are checked.
+    bool sample()
+    {
+      samples++;
+      bool inReadSlot = false;
+      if (lastPulseKind == ShortPulse && drive != MasterLow && !slotSampled) {
+        uint64_t sinceFall = simNowNs - fellAt;
+        if (sinceFall < SpecMinSlotNs) {
+          slotSampled = true;
+          inReadSlot = true;
+          if (sinceFall > SpecMaxReadSampleNs) violation("read slot sampled later than 15us");
+        }
+      }
+      bool b = level();
+      if (inReadSlot && noiseRate > 0) {
+        noiseSeed = noiseSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+        if ((noiseSeed >> 11) * (1.0 / 9007199254740992.0) < noiseRate) {
+          flippedBits++;
+          b = !b;
+        }
+      }
+      return b;
+    }
+
+    void report(const char *name)
+    {
+      printf("%s: %lu resets, %lu write-0 slots, %lu write-1/read slots, %lu samples, %lu timing violations",
+             name, resetPulses, writeZeroSlots, shortSlots, samples, violations);
+      if (violations) printf(" (last: %s at %.1fus)", lastViolation, lastViolationAt / 1000.0);
+      printf("\n");
+    }
+};
+
+
+// ---------------- Ports
+
+class SimulatedPort
+{
+    byte ddr;
+    byte latch;
+
+    static byte readPin(void *p) { return ((SimulatedPort *) p)->pins(0xFF); }
+    static byte readPinMasked(void *p, byte mask) { return ((SimulatedPort *) p)->pins(mask); }
+    static void writePin(void *p, byte v) { SimulatedPort *port = (SimulatedPort *) p; port->setLatch(port->latch ^ v); }   // Writing PINx toggles PORTx
+    static byte readDdr(void *p) { return ((SimulatedPort *) p)->ddr; }
+    static void writeDdr(void *p, byte v) { ((SimulatedPort *) p)->setDdr(v); }
+    static byte readPort(void *p) { return ((SimulatedPort *) p)->latch; }
+    static void writePort(void *p, byte v) { ((SimulatedPort *) p)->setLatch(v); }
+
+    void update()
+    {
+      for (byte i = 0; i < 8; i++) {
+        byte mask = 1 << i;
+        byte d = (ddr & mask) ? ((latch & mask) ? MasterHigh : MasterLow) : MasterReleased;
+        wire[i].setMasterDrive(d);
+      }
+    }
+
+    void setDdr(byte v) { ddr = v; update(); }
+    void setLatch(byte v) { latch = v; update(); }
+
+    byte pins(byte mask)
+    {
+      byte result = 0;
+      for (byte i = 0; i < 8; i++) {
+        if ((mask & (1 << i)) && wire[i].sample()) result |= (1 << i);
+      }
+      return result;
+    }
+
+  public:
+    SimulatedWire wire[8];
+    SimulatedRegister pinRegister;
+    SimulatedRegister ddrRegister;
+    SimulatedRegister portRegister;
+
+    SimulatedPort() : ddr(0), latch(0),
+      pinRegister(this, readPin, writePin, readPinMasked),
+      ddrRegister(this, readDdr, writeDdr),
+      portRegister(this, readPort, writePort) {}
+};
+
+SimulatedPort simPortB, simPortC, simPortD;
+
+#define PINB  (simPortB.pinRegister)
+#define DDRB  (simPortB.ddrRegister)
+#define PORTB (simPortB.portRegister)
+#define PINC  (simPortC.pinRegister)
+#define DDRC  (simPortC.ddrRegister)
+#define PORTC (simPortC.portRegister)
+#define PIND  (simPortD.pinRegister)
+#define DDRD  (simPortD.ddrRegister)
+#define PORTD (simPortD.portRegister)
+
+
+// ---------------- TIMER2
+
+#define WGM20 0
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+class SimulatedTimer2
+{
+    byte controlA, controlB, compareA, mask;
+    byte countAtBase;        // TCNT2 was countAtBase at virtual time baseNs...
+    uint64_t baseNs;         // ... and has been counting since then if the clock is running.
+
+    static uint64_t prescaler(byte cs)
+    {
+      static const uint16_t divisors[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+      return divisors[cs & 0x07];
+    }
+
+    bool ctc() const { return (controlA & (1 << WGM21)) != 0; }
+
+    // Counts from c, where does it go after n ticks?
+    byte countAfter(byte c, uint64_t n) const
+    {
+      if (ctc() && c <= compareA) {
+        uint64_t period = (uint64_t) compareA + 1;
+        return (byte) ((c + n) % period);
+      }
+      return (byte) ((c + n) % 256);
+    }
+
+    // Brings countAtBase up to date without losing the part of a tick the prescaler has
+    // already counted, so that writing OCR2A doesn't nudge the counter.
+    void rebase()
+    {
+      uint64_t tick = tickNs();
+      if (tick == 0) {           // Clock stopped: it will start counting from now.
+        baseNs = simNowNs;
+        return;
+      }
+      if (simNowNs < baseNs) return;
+      uint64_t n = (simNowNs - baseNs) / tick;
+      countAtBase = countAfter(countAtBase, n);
+      baseNs += n * tick;
+    }
+
+    static byte rdA(void *p) { return ((SimulatedTimer2 *) p)->controlA; }
+    static void wrA(void *p, byte v) { SimulatedTimer2 *t = (SimulatedTimer2 *) p; t->rebase(); t->controlA = v; }
+    static byte rdB(void *p) { return ((SimulatedTimer2 *) p)->controlB; }
+    static void wrB(void *p, byte v) { SimulatedTimer2 *t = (SimulatedTimer2 *) p; t->rebase(); t->controlB = v; }
+    static byte rdCnt(void *p) { return ((SimulatedTimer2 *) p)->count(); }
+    static void wrCnt(void *p, byte v) { SimulatedTimer2 *t = (SimulatedTimer2 *) p; t->countAtBase = v; t->baseNs = simNowNs; }
+    static byte rdOcr(void *p) { return ((SimulatedTimer2 *) p)->compareA; }
+    static void wrOcr(void *p, byte v) { SimulatedTimer2 *t = (SimulatedTimer2 *) p; t->rebase(); t->compareA = v; }
+    static byte rdMsk(void *p) { return ((SimulatedTimer2 *) p)->mask; }
+    static void wrMsk(void *p, byte v) { ((SimulatedTimer2 *) p)->mask = v; }
+    // We don't keep interrupt flags: a match while the ISR is running is never delivered,
+    // so there is never anything for a write to TIFR2 to clear.
+    static byte rdFlags(void *) { return 0; }
+    static void wrFlags(void *, byte) {}
+
+  public:
+    void (*compareMatchA)();        // The TIMER2_COMPA_vect ISR, once one has been defined.
+    unsigned long interruptCount;   // Timeslices handed out so far.
+    uint64_t longestIsrNs;          // Diagnostic, like ISR_max_busytime on the real thing.
+
+    SimulatedRegister TCCR2ARegister, TCCR2BRegister, TCNT2Register, OCR2ARegister, TIMSK2Register, TIFR2Register;
+
+    SimulatedTimer2() : controlA(0), controlB(0), compareA(0), mask(0), countAtBase(0), baseNs(0),
+      compareMatchA(NULL), interruptCount(0), longestIsrNs(0),
+      TCCR2ARegister(this, rdA, wrA), TCCR2BRegister(this, rdB, wrB), TCNT2Register(this, rdCnt, wrCnt),
+      OCR2ARegister(this, rdOcr, wrOcr), TIMSK2Register(this, rdMsk, wrMsk), TIFR2Register(this, rdFlags, wrFlags) {}
+
+    uint64_t tickNs() const
+    {
+      uint64_t p = prescaler(controlB);
+      return p ? (p * 1000000000ULL) / F_CPU : 0;
+    }
+
+    byte count() const
+    {
+      uint64_t tick = tickNs();
+      if (tick == 0 || simNowNs < baseNs) return countAtBase;   // Clock stopped, or the first tick isn't in yet
+      return countAfter(countAtBase, (simNowNs - baseNs) / tick);
+    }
+
+    // When will TCNT2 next reach OCR2A?  Never, if the timer or the interrupt is off.
+    uint64_t nextMatchNs() const
+    {
+      uint64_t tick = tickNs();
+      if (tick == 0 || compareMatchA == NULL || !(mask & (1 << OCIE2A))) return UINT64_MAX;
+      uint64_t ticks = compareA > countAtBase ? compareA - countAtBase : 256 - countAtBase + compareA;
+      return baseNs + ticks * tick;
+    }
+
+    // Virtual time has reached a compare match: clear (in CTC mode) and run the ISR.
+    void fire(uint64_t at)
+    {
+      uint64_t tick = tickNs();
+      countAtBase = ctc() ? 0 : (byte) (compareA + 1);
+      baseNs = at + tick;
+
+      if (simNowNs < at) simNowNs = at;
+      uint64_t entered = simNowNs;
+      simNowNs += simIsrOverheadNs;
+      simInIsr = true;
+      compareMatchA();
+      simInIsr = false;
+      interruptCount++;
+      if (simNowNs - entered > longestIsrNs) longestIsrNs = simNowNs - entered;
+    }
+};
+
+SimulatedTimer2 simTimer2;
+
+#define TCCR2A (simTimer2.TCCR2ARegister)
+#define TCCR2B (simTimer2.TCCR2BRegister)
+#define TCNT2  (simTimer2.TCNT2Register)
+#define OCR2A  (simTimer2.OCR2ARegister)
+#define TIMSK2 (simTimer2.TIMSK2Register)
+#define TIFR2  (simTimer2.TIFR2Register)
+
+// ISR(TIMER2_COMPA_vect) { ... } defines an ordinary function and hooks it up to the timer.
+struct SimulatedVector {
+  SimulatedVector(void (*handler)()) { simTimer2.compareMatchA = handler; }
+};
+#define ISR(vector) void vector(); SimulatedVector vector##_hook(vector); void vector()
+
+
+void simServiceInterrupts()
+{
+  while (simInterruptsEnabled && !simInIsr) {
+    uint64_t due = simTimer2.nextMatchNs();
+    if (due > simNowNs) break;
+    simTimer2.fire(due);
+  }
+}
+
+void simRun(uint64_t untilNs)
+{
+  while (simInterruptsEnabled && !simInIsr) {
+    uint64_t due = simTimer2.nextMatchNs();
+    if (due > untilNs) break;
+    simTimer2.fire(due);
+  }
+  if (simNowNs < untilNs) simNowNs = untilNs;
+}
+
+#endif // ARDUINO
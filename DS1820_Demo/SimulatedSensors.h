@@ -0,0 +1,475 @@
+#pragma once
+
+// Simulated DS18B20 (family 0x28) and DS1820 / DS18S20 (family 0x10) sensors,
+// to hang on the wires of SimulatedBus.h.  Host builds only.
+//
+// Each device follows the slot timing of the real parts: it samples the master's
+// write slots 30us after the falling edge, answers read slots by holding the line
+// low for 30us, and answers a reset with a presence pulse.  It understands the
+// ROM commands SEARCHROM, ALARMSEARCH, READROM, MATCH ROM and SKIP ROM, and the
+// function commands STARTCONVO, READSCRATCH, WRITESCRATCH, COPYSCRATCH and READPOWERSUPPLY.
+//
+// conversionNs is the conversion time at 12 bits.  A DS18B20 set to a lower resolution
+// converts in proportion (half the time per bit less), and leaves the undefined low
+// bits of its reading 0.
+//
+// The alarm flag works as on the real parts: each conversion sets it if the whole
+// degrees are at or above TH (scratchpad byte 2) or at or below TL (byte 3).
+//
+// Like the real parts, a busy device answers read slots with 0 until its
+// conversion is done, and does not touch the line otherwise.  Set
+// holdsBusWhileConverting to model a device that keeps the whole line low instead.
+//
+// Set parasitic for a two-wire device that takes its power from the data line.  It
+// answers READPOWERSUPPLY with a 0, and its conversions only work if the master drives
+// the line high within 10us of STARTCONVO, and keeps it there until the conversion is
+// done.  Otherwise it browns out, and the conversion reads 85C, as the real ones do.
+//
+// Family 0x10 devices default to behaving like the cheap clones that getRaw()
+// has its straight-line correction for; clear cheapClone for a genuine DS18S20.
+//
+// The conversion time and the temperature are per device: set conversionNs,
+// and either temperatureC or a temperatureAt script that is asked for the
+// temperature at the moment each conversion completes.
+//
+// SimulatedSensorFleet makes it easy to hang hundreds of these on one wire.
+
+#ifndef ARDUINO
+
+#include <deque>
+#include <functional>
+
+#include "SimulatedBus.h"
+
+// The 1-wire commands the devices understand (the same values as AsyncTemperatures.h)
+#define SEARCHROM       0xF0
+#define ALARMSEARCH     0xEC
+#define READROM         0x33
+#define STARTCONVO      0x44
+#define READSCRATCH     0xBE
+#define WRITESCRATCH    0x4E
+#define COPYSCRATCH     0x48
+#define SELECTDEVICE    0x55
+#define SKIPROMWILDCARD 0xCC
+#define READPOWERSUPPLY 0xB4
+
+// Dallas CRC8, polynomial x^8 + x^5 + x^4 + 1, as the devices compute it.
+inline byte simCrc8(const byte *data, byte len)
+{
+  byte crc = 0;
+  while (len--) {
+    byte b = *data++;
+    for (byte i = 0; i < 8; i++) {
+      byte mix = (crc ^ b) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      b >>= 1;
+    }
+  }
+  return crc;
+}
+
+class SimulatedDS18B20 : public SimulatedSlave
+{
+  public:
+    byte rom[8];
+    byte scratchpad[9];
+
+    uint64_t conversionNs;                       // How long a conversion takes
+    double temperatureC;                         // What the next conversion will read ...
+    std::function<double(uint64_t)> temperatureAt; // ... unless this script is set.  Given virtual time in ns.
+    bool holdsBusWhileConverting;
+    bool cheapClone;                             // Family 0x10 only: reads way off, like the clones getRaw() calibrates for.
+    double noiseRate;                            // A bad cable run to this device: the chance each bit it sends is flipped.
+    bool parasitic;                              // Powered from the data line, see above.
+
+    // Slot timing of this particular part
+    uint64_t writeSampleNs;       // When, after the falling edge, a write slot is sampled
+    uint64_t readHoldNs;          // How long a 0 is held low in a read slot
+    uint64_t resetDetectNs;       // A low at least this long is taken as a reset
+    uint64_t presenceWaitNs;      // tPDH
+    uint64_t presenceLowNs;       // tPDL
+
+    unsigned long conversions;    // Diagnostics
+    unsigned long scratchpadReads;
+    unsigned long brownOuts;      // Conversions that failed for want of a strong pull-up
+
+  private:
+    static const byte Idle = 0;            // Waiting for a reset
+    static const byte RomCommand = 1;      // Receiving a ROM command byte
+    static const byte Searching = 2;
+    static const byte MatchingRom = 3;
+    static const byte FunctionCommand = 4; // Receiving a function command byte
+    static const byte Transmitting = 5;    // Sending txBuf, then 1's
+    static const byte ReportingBusy = 6;   // After STARTCONVO: read slots return 0 until done
+    static const byte Writing = 7;         // After WRITESCRATCH: receiving TH, TL (and config)
+
+    byte state;
+    byte rxByte, rxCount;          // Bits arrive LSB first
+    byte bitIndex;                 // For searching and matching
+    byte searchPhase;              // 0: send bit, 1: send complement, 2: receive direction
+    const byte *txBuf;
+    byte txBits, txIndex;
+    bool converting;
+    bool inAlarm;                  // Set or cleared by each conversion
+    byte eeprom[3];                // TH, TL, config: what the scratchpad gets at power-on
+    byte writeIndex;               // Which scratchpad byte WRITESCRATCH fills next
+    uint64_t conversionDoneAt;
+    uint64_t conversionStartedAt;
+    bool starved;                  // Parasitic, and the conversion in progress didn't get its strong pull-up.
+    uint64_t holdFrom, holdUntil;
+    uint64_t noiseSeed;
+
+    static bool bitOf(const byte *buf, byte i) { return (buf[i / 8] >> (i % 8)) & 0x01; }
+
+    void hold(uint64_t from, uint64_t length)
+    {
+      holdFrom = from;
+      holdUntil = from + length;
+    }
+
+    void finishConversion(uint64_t t)
+    {
+      if (!converting || t < conversionDoneAt) return;
+      converting = false;
+      double c = temperatureAt ? temperatureAt(conversionDoneAt) : temperatureC;
+      if (starved) {
+        brownOuts++;
+        c = 85.0;                  // The power-on value: what a failed conversion leaves behind.
+      }
+      setTemperature(c);
+      int wholeDegrees = (int) floor(c);
+      inAlarm = wholeDegrees >= (int8_t) scratchpad[2] || wholeDegrees <= (int8_t) scratchpad[3];
+    }
+
+    void startTransmitting(const byte *buf, byte bits)
+    {
+      txBuf = buf;
+      txBits = bits;
+      txIndex = 0;
+      state = Transmitting;
+    }
+
+    void romCommand(byte cmd, uint64_t /*t*/)
+    {
+      switch (cmd) {
+        case ALARMSEARCH:
+          if (!inAlarm) {
+            state = Idle;      // Only devices in alarm take part.
+            break;
+          }
+          // fall through
+        case SEARCHROM:
+          state = Searching;
+          bitIndex = 0;
+          searchPhase = 0;
+          break;
+        case READROM:
+          startTransmitting(rom, 64);
+          break;
+        case SELECTDEVICE:
+          state = MatchingRom;
+          bitIndex = 0;
+          break;
+        case SKIPROMWILDCARD:
+          state = FunctionCommand;
+          break;
+        default:
+          state = Idle;
+      }
+    }
+
+    void functionCommand(byte cmd, uint64_t t)
+    {
+      switch (cmd) {
+        case STARTCONVO:
+          converting = true;
+          conversionDoneAt = t + (conversionNs >> (12 - resolution()));
+          conversionStartedAt = t;
+          starved = parasitic;     // Until the master drives the line high.
+          conversions++;
+          state = ReportingBusy;
+          break;
+        case READSCRATCH:
+          scratchpad[8] = simCrc8(scratchpad, 8);
+          scratchpadReads++;
+          startTransmitting(scratchpad, 72);
+          break;
+        case WRITESCRATCH:
+          state = Writing;
+          writeIndex = 2;
+          break;
+        case COPYSCRATCH:
+          memcpy(eeprom, scratchpad + 2, family() == 0x10 ? 2 : 3);
+          state = Idle;
+          break;
+        case READPOWERSUPPLY: {
+            static const byte zero = 0x00, one = 0x01;
+            startTransmitting(parasitic ? &zero : &one, 1);
+          }
+          break;
+        default:
+          state = Idle;
+      }
+    }
+
+    // Returns true when a whole byte has arrived in rxByte.
+    bool receiveBit(bool b)
+    {
+      rxByte = (rxByte >> 1) | (b ? 0x80 : 0);
+      return ++rxCount == 8;
+    }
+
+    // The bit this device puts on the wire in the current slot, if it is talking.
+    bool transmitBit(bool &b)
+    {
+      switch (state) {
+        case Transmitting:
+          b = txIndex < txBits ? bitOf(txBuf, txIndex) : 1;
+          return true;
+        case Searching:
+          if (searchPhase == 2) return false;
+          b = bitOf(rom, bitIndex) ^ (searchPhase == 1);
+          return true;
+        case ReportingBusy:
+          b = !converting;
+          return true;
+      }
+      return false;
+    }
+
+  public:
+    SimulatedDS18B20(const byte *romID)
+      : conversionNs(750000000ULL), temperatureC(21.5), holdsBusWhileConverting(false),
+        cheapClone(romID[0] == 0x10), noiseRate(0), parasitic(false),
+        writeSampleNs(30000), readHoldNs(30000), resetDetectNs(120000),
+        presenceWaitNs(30000), presenceLowNs(120000),
+        conversions(0), scratchpadReads(0), brownOuts(0),
+        state(Idle), rxByte(0), rxCount(0), bitIndex(0), searchPhase(0),
+        txBuf(NULL), txBits(0), txIndex(0), converting(false), inAlarm(false), writeIndex(0), conversionDoneAt(0),
+        conversionStartedAt(0), starved(false),
+        holdFrom(0), holdUntil(0), noiseSeed(romID[1] | 1)
+    {
+      memcpy(rom, romID, 8);
+      static const byte factory[3] = {0x4B, 0x46, 0x7F};   // TH 75, TL 70, 12 bits
+      memcpy(eeprom, factory, 3);
+      powerOn();
+    }
+
+    // A device with the given family code and 48-bit serial number, and a valid ROM CRC.
+    SimulatedDS18B20(byte family, uint64_t serial)
+      : SimulatedDS18B20(makeRom(family, serial).id) {}
+
+    struct RomID { byte id[8]; };
+    static RomID makeRom(byte family, uint64_t serial)
+    {
+      RomID r;
+      r.id[0] = family;
+      for (byte i = 1; i < 7; i++) r.id[i] = (serial >> (8 * (i - 1))) & 0xFF;
+      r.id[7] = simCrc8(r.id, 7);
+      return r;
+    }
+
+    byte family() const { return rom[0]; }
+
+    // 9 to 12 bits.  Family 0x10 parts have no config register, and act like 12.
+    byte resolution() const { return family() == 0x10 ? 12 : 9 + ((scratchpad[4] >> 5) & 0x03); }
+
+    // The scratchpad as it powers up, reading 85 degrees.
+    void powerOn()
+    {
+      static const byte ds18b20[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0};
+      static const byte ds1820[9] = {0xAA, 0x00, 0x4B, 0x46, 0xFF, 0xFF, 0x0C, 0x10, 0};
+      memcpy(scratchpad, family() == 0x10 ? ds1820 : ds18b20, 9);
+      memcpy(scratchpad + 2, eeprom, family() == 0x10 ? 2 : 3);
+      scratchpad[8] = simCrc8(scratchpad, 8);
+      converting = false;
+      inAlarm = false;
+      state = Idle;
+    }
+
+    // Puts a temperature into the scratchpad, encoded the way this family does it.
+    void setTemperature(double c)
+    {
+      if (family() == 0x10) {
+        if (cheapClone) {
+          // Undo the straight-line correction in getRaw(), so the clone is "wrong" in
+          // exactly the way the reader expects.
+          c = (c * 128.0 - 8900.0) / 1.29 / 128.0;
+        }
+        // Half degrees in the temperature register.  The extended resolution comes from
+        // TEMP = TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+        // (The clones leave out the 0.25, as getRaw() does.)
+        double wholeDegrees = floor(c);
+        // The clones truncate to whole degrees, and leave the rest to the count.
+        int16_t raw = cheapClone ? (int16_t) wholeDegrees * 2 : (int16_t) lround(c * 2);
+        int countRemain = 16 - (int) lround((c - wholeDegrees + (cheapClone ? 0 : 0.25)) * 16);
+        if (countRemain < 0) countRemain = 0;
+        if (countRemain > 16) countRemain = 16;
+        scratchpad[0] = raw & 0xFF;
+        scratchpad[1] = (raw >> 8) & 0xFF;
+        scratchpad[6] = countRemain;
+        scratchpad[7] = 0x10;
+      }
+      else {
+        int16_t raw = (int16_t) lround(c * 16);   // Sixteenths of a degree at 12 bits
+        raw &= ~((1 << (12 - resolution())) - 1); // Coarser resolutions leave the low bits 0
+        scratchpad[0] = raw & 0xFF;
+        scratchpad[1] = (raw >> 8) & 0xFF;
+      }
+      scratchpad[8] = simCrc8(scratchpad, 8);
+    }
+
+    bool isConverting(uint64_t t)
+    {
+      finishConversion(t);
+      return converting;
+    }
+
+    virtual void masterPulledLow(uint64_t t)
+    {
+      finishConversion(t);
+      bool b;
+      if (transmitBit(b)) {
+        if (noiseRate > 0) {
+          noiseSeed = noiseSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+          if ((noiseSeed >> 11) * (1.0 / 9007199254740992.0) < noiseRate) b = !b;
+        }
+        if (!b) hold(t, readHoldNs);
+      }
+    }
+
+    virtual void masterReleased(uint64_t t, uint64_t lowNs)
+    {
+      finishConversion(t);
+      if (lowNs >= resetDetectNs) {
+        // Reset: abandon whatever we were doing (but not a conversion) and say we're here.
+        state = RomCommand;
+        rxByte = rxCount = 0;
+        hold(t + presenceWaitNs, presenceLowNs);
+        return;
+      }
+
+      bool written = lowNs < writeSampleNs;   // Still low when we sample means the master wrote a 0.
+
+      switch (state) {
+        case RomCommand:
+          if (receiveBit(written)) {
+            rxCount = 0;
+            romCommand(rxByte, t);
+          }
+          break;
+
+        case FunctionCommand:
+          if (receiveBit(written)) {
+            rxCount = 0;
+            functionCommand(rxByte, t);
+          }
+          break;
+
+        case MatchingRom:
+          if (written != bitOf(rom, bitIndex)) {
+            state = Idle;      // Not us.  Sit out until the next reset.
+          }
+          else if (++bitIndex == 64) {
+            state = FunctionCommand;
+          }
+          break;
+
+        case Searching:
+          if (searchPhase < 2) {
+            searchPhase++;
+          }
+          else if (written != bitOf(rom, bitIndex)) {
+            state = Idle;      // The master went the other way down the tree.
+          }
+          else {
+            searchPhase = 0;
+            if (++bitIndex == 64) state = FunctionCommand;
+          }
+          break;
+
+        case Transmitting:
+          txIndex++;
+          break;
+
+        case Writing:
+          if (receiveBit(written)) {
+            rxCount = 0;
+            // Config: only R1 and R0 can be written, the other bits always read 1 (bit 7 reads 0).
+            scratchpad[writeIndex] = writeIndex == 4 ? (rxByte & 0x60) | 0x1F : rxByte;
+            scratchpad[8] = simCrc8(scratchpad, 8);
+            if (++writeIndex > (family() == 0x10 ? 3 : 4)) state = Idle;   // Anything more is ignored.
+          }
+          break;
+      }
+    }
+
+    virtual void masterDrive(uint64_t t, byte drive)
+    {
+      finishConversion(t);
+      if (!parasitic || !converting) return;
+      if (drive == MasterHigh) {
+        if (t - conversionStartedAt <= 10000) starved = false;   // tSPON: the pull-up is on in time.
+      }
+      else {
+        starved = true;            // Let go of, or pulled low, before we were done.
+      }
+    }
+
+    virtual bool holdsLow(uint64_t t)
+    {
+      if (t >= holdFrom && t < holdUntil) return true;
+      return holdsBusWhileConverting && isConverting(t);
+    }
+};
+
+
+// Owns a batch of simulated sensors and attaches them to a wire.
+class SimulatedSensorFleet
+{
+    uint64_t seed;
+
+    uint64_t nextRandom()
+    {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      return seed >> 16;
+    }
+
+  public:
+    std::deque<SimulatedDS18B20> devices;   // A deque, so adding devices never moves the ones attached already.
+
+    SimulatedSensorFleet(uint64_t randomSeed = 1) : seed(randomSeed) {}
+
+    SimulatedDS18B20 &add(SimulatedWire &wire, const byte *romID)
+    {
+      devices.push_back(SimulatedDS18B20(romID));
+      wire.attach(&devices.back());
+      return devices.back();
+    }
+
+    // Adds count devices of one family, with random serial numbers, conversion times
+    // spread between minConversionNs and maxConversionNs, and temperatures between
+    // minC and maxC.
+    void addRandom(SimulatedWire &wire, int count, byte family,
+                   uint64_t minConversionNs = 750000000ULL, uint64_t maxConversionNs = 750000000ULL,
+                   double minC = 15.0, double maxC = 35.0)
+    {
+      for (int i = 0; i < count; i++) {
+        SimulatedDS18B20::RomID r = SimulatedDS18B20::makeRom(family, nextRandom() & 0xFFFFFFFFFFFFULL);
+        SimulatedDS18B20 &d = add(wire, r.id);
+        d.conversionNs = minConversionNs + nextRandom() % (maxConversionNs - minConversionNs + 1);
+        d.temperatureC = minC + (maxC - minC) * (nextRandom() % 1000) / 1000.0;
+      }
+    }
+
+    SimulatedDS18B20 *find(const byte *romID)
+    {
+      for (size_t i = 0; i < devices.size(); i++) {
+        if (memcmp(devices[i].rom, romID, 8) == 0) return &devices[i];
+      }
+      return NULL;
+    }
+};
+
+#endif // ARDUINO
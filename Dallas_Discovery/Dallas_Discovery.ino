@@ -8,7 +8,7 @@ void setup(void) {
   Serial.begin(115200);
   Serial.println("Sensor Discovery Example"); 
 
-  SensorDiscovery sd;
+  SensorDiscovery<PortB, 0b00010000> sd;   // PORTB bit 4: pin 12 on a UNO, pin 10 on a Mega
 
   byte response;
   sd.begin(buf);
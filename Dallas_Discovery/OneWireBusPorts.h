@@ -0,0 +1,60 @@
+// The bus ports, shared by AsyncTemperatures.h and SensorDiscovery.h.
+// Each port is a little type that knows its three registers, so the port and pin can be
+// template parameters and still compile to single sbi / cbi / sbis instructions.
+// pullHigh() and endPullHigh() are the strong pull-up for parasitically powered devices.
+//
+// The Arduino IDE only looks in the sketch's own folder, so DS1820_Demo and
+// Dallas_Discovery each carry this same file.  Change one, change the other.  The
+// guard (rather than just #pragma once) keeps the two copies from clashing when a
+// host build sees both.
+
+#pragma once
+
+#ifndef ONEWIRE_BUS_PORTS
+#define ONEWIRE_BUS_PORTS
+
+#define DeclareBusPort(P)                                                                     \
+  struct Port##P {                                                                            \
+    static inline void pullLow(byte mask) { DDR##P |= mask; PORT##P &= ~mask; }  /* OUTPUT, LOW */ \
+    static inline void release(byte mask) { DDR##P &= ~mask; }          /* INPUT, high impedance */ \
+    static inline byte sample(byte mask)  { return PIN##P & mask; }                          \
+    static inline void pullHigh(byte mask) { PORT##P |= mask; DDR##P |= mask; }  /* OUTPUT, HIGH: strong pull-up */ \
+    static inline void endPullHigh(byte mask) { DDR##P &= ~mask; PORT##P &= ~mask; }  /* INPUT, no internal pull-up */ \
+  };
+
+#ifdef PORTA
+DeclareBusPort(A)
+#endif
+#ifdef PORTB
+DeclareBusPort(B)
+#endif
+#ifdef PORTC
+DeclareBusPort(C)
+#endif
+#ifdef PORTD
+DeclareBusPort(D)
+#endif
+#ifdef PORTE
+DeclareBusPort(E)
+#endif
+#ifdef PORTF
+DeclareBusPort(F)
+#endif
+#ifdef PORTG
+DeclareBusPort(G)
+#endif
+#ifdef PORTH
+DeclareBusPort(H)
+#endif
+#ifdef PORTJ
+DeclareBusPort(J)
+#endif
+#ifdef PORTK
+DeclareBusPort(K)
+#endif
+#ifdef PORTL
+DeclareBusPort(L)
+#endif
+
+#undef DeclareBusPort
+#endif // ONEWIRE_BUS_PORTS
@@ -1,29 +1,33 @@
-
 // Pete Wentworth 2 April 2020.
 // Enumerate Dallas devices / DS1820-type devices on a 1-Wire bus.
 // When I finally understood the fiendishly clever device enumeration algorithm,
 // I had to try it for myself.  Using the OneWire and DallasTemperature libraries
 // are probably your better bet, but this is a nice companion to my AsyncTemperature
 // library. Most of the explanation is on GitHub.
-// The OneWire pin is hardwired.  I don't support parasitic mode yet.
+// The OneWire port and pin are template parameters.  I don't support parasitic mode yet.
 
 #pragma once
 
+#ifdef ARDUINO
 #include <util/delay.h>   // For _delay_us() which is more accurate than delayMicroseconds
+#else
+#include "SimulatedBus.h" // Host build: simulated ports and virtual time, see DS1820_Demo.
+#endif
+#include "OneWireBusPorts.h"   // PortB and friends: the same as AsyncTemperatures.h uses.
 
 #define SEARCHROM       0xF0  // Initiates the next cycle of device discovery.
 
+// Wiring:
+// SensorDiscovery<PortB, 0b00010000> uses PORTB, bit 4.
+// On a UNO, PORTB, bit 4 maps to pin 12.  Connect your 1-wire bus there.
+// On a Mega2560, PORTB bit 4 maps to pin 10.
+template <class BusPort, byte busPinMask>
 class SensorDiscovery
 {
-    // Wiring:
-    // On a UNO, PORTB, bit 4 maps to pin 12.  Connect your 1-wire bus there.
-    // On a Mega2560, PORTB bit 4 maps to pin 10.
-    const byte busPinMask = 0b00010000;
-
 // -------- Ignoring parasitic mode, there are only three valid "electrical" moves on a 1-wire bus:
-#define pullBusLow()    DDRB |= busPinMask; PORTB &= ~busPinMask  
-#define releaseBus()    DDRB &= ~busPinMask              // Set direction for INPUT, i.e. high impedance
-#define sampleBus()    (((byte) PINB & busPinMask) != 0)
+    static inline void pullBusLow() { BusPort::pullLow(busPinMask); }
+    static inline void releaseBus() { BusPort::release(busPinMask); }   // Set direction for INPUT, i.e. high impedance
+    static inline byte sampleBus()  { return BusPort::sample(busPinMask) != 0; }
 // --------
 
   private:
@@ -148,7 +152,8 @@ class SensorDiscovery
         }
         unsetForkPoint(frozenTreeDepth);
         setBitInID(frozenTreeDepth);     // force the search to go to the right at this point.
-        frozenTreeDepth++;
+        // Note: the fork itself stays frozen.  Anything deeper is free to fork again, even
+        // the very next bit, so we don't bump frozenTreeDepth past it.
       }
 
       byte chooseRight = 42;
@@ -212,3 +217,11 @@ class SensorDiscovery
     }
 
 };
+
+// The bit macros are private to the class: don't let them leak into the sketch.
+#undef setBitInID
+#undef unsetBitInID
+#undef isBitInID
+#undef setForkPoint
+#undef unsetForkPoint
+#undef isForkPoint
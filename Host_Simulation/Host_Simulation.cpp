@@ -0,0 +1,1036 @@
+// Runs the AsyncTemperatureReader interpreter on a Linux host, against the
+// simulated bus in SimulatedBus.h and the simulated sensors in SimulatedSensors.h,
+// and reports how many timeslices and how much (virtual) bus time each kind of
+// transaction takes, plus any 1-wire timing the simulated wire considers out of spec.
+//
+// Build and run from the repository root with
+//     g++ -std=c++11 -O2 -I DS1820_Demo -I Dallas_Discovery -o host_sim Host_Simulation/Host_Simulation.cpp && ./host_sim
+
+#include "AsyncTemperatures.h"
+#include "SensorDiscovery.h"
+#include "SimulatedSensors.h"
+
+typedef byte DeviceAddress[8];
+typedef byte ScratchPad[9];
+
+// The two sensors hard-wired into DS1820_Demo.ino
+DeviceAddress device[] =
+{ {0x10, 0x31, 0x41, 0x26, 0x00, 0x08, 0x00, 0x0A},
+  {0x28, 0xFF, 0x6F, 0x45, 0x80, 0x14, 0x02, 0x5E}
+};
+ScratchPad sPad;
+
+SimulatedWire &theWire = simPortB.wire[4];   // myTemperatureSensors is on PORTB bit 4
+
+// Runs the simulation until the reader has nothing left to do, then reports.
+void measure(const char *label)
+{
+  unsigned long slicesBefore = simTimer2.interruptCount;
+  uint64_t startedAt = simNowNs;
+
+  while (myTemperatureSensors.getStatus() & (StillBusy | DevicesAreBusy)) {
+    delayMicroseconds(100);
+  }
+
+  printf("%-28s %6lu timeslices %10.1fus  status=0x%02X\n", label,
+         simTimer2.interruptCount - slicesBefore, (simNowNs - startedAt) / 1000.0,
+         myTemperatureSensors.getStatus());
+}
+
+void transactions()
+{
+  SimulatedSensorFleet fleet;
+  fleet.add(theWire, device[0]).temperatureC = 19.25;
+  fleet.add(theWire, device[1]).temperatureC = 23.5;
+
+  printf("Two sensors on the bus\n");
+  myTemperatureSensors.resetAsync();
+  measure("resetAsync");
+
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  measure("convertAllTemperaturesAsync");
+  delay(800);   // Powered sensors don't hold the bus low, so give them the datasheet time.
+
+  for (int i = 0; i < 2; i++) {
+    myTemperatureSensors.readScratchpadAsync(device[i], sPad);
+    measure("readScratchpadAsync");
+    printf("    %02X...  %.2fC\n", device[i][0], myTemperatureSensors.getTempC(device[i], sPad));
+    myTemperatureSensors.readTemperatureAsync(device[i], sPad);
+    measure("readTemperatureAsync");
+    printf("    %02X...  %.2fC\n", device[i][0], myTemperatureSensors.getTempC(device[i], sPad));
+  }
+
+  theWire.detachAll();
+  fleet.add(theWire, device[1]);
+  myTemperatureSensors.readUniqueScratchpadAsync(sPad);
+  measure("readUniqueScratchpadAsync");
+
+  theWire.detachAll();
+}
+
+void discovery(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28);
+  printf("\n%d sensors on the bus\n", numDevices);
+
+  DeviceAddress found[numDevices];
+  byte buf[8];
+  SensorDiscovery<PortB, 0b00010000> sd;
+  uint64_t startedAt = simNowNs;
+  int count = 0;
+  sd.begin(buf);
+  while (count < numDevices && sd.findNextDevice() == 0) {
+    memcpy(found[count++], buf, 8);
+  }
+  printf("SensorDiscovery found %d in %.1fms (blocking)\n", count, (simNowNs - startedAt) / 1e6);
+
+  // The same search in the background, while the main loop keeps polling.
+  DeviceAddress table[numDevices];
+  long loops = 0;
+  startedAt = simNowNs;
+  myTemperatureSensors.findDevicesAsync(table, numDevices);
+  while (myTemperatureSensors.getStatus() & StillBusy) {
+    delayMicroseconds(100);
+    loops++;
+  }
+  int numFound = myTemperatureSensors.getNumDevicesFound();
+  int same = 0;
+  for (int i = 0; i < numFound && i < count; i++) {
+    if (memcmp(table[i], found[i], 8) == 0) same++;
+  }
+  printf("findDevicesAsync found %d in %.1fms (%ld main loop passes meanwhile, %d the same as SensorDiscovery), status=0x%02x\n",
+         numFound, (simNowNs - startedAt) / 1e6, loops, same, myTemperatureSensors.getStatus());
+
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  measure("convertAllTemperaturesAsync");
+  delay(800);
+
+  int good = 0;
+  uint64_t readStartedAt = simNowNs;
+  for (int i = 0; i < count; i++) {
+    myTemperatureSensors.readScratchpadAsync(found[i], sPad);
+    while (myTemperatureSensors.getStatus() & StillBusy) delayMicroseconds(100);
+    SimulatedDS18B20 *d = fleet.find(found[i]);
+    if (d && fabs(myTemperatureSensors.getTempC(found[i], sPad) - d->temperatureC) < 0.07) good++;
+  }
+  printf("Read %d scratchpads in %.1fms, %d matched the simulated temperature\n",
+         count, (simNowNs - readStartedAt) / 1e6, good);
+  theWire.detachAll();
+}
+
+// Compares scanning a fleet the way DS1820_Demo's step-by-step state machine does it,
+// one main-loop round trip per step, against one readAllScratchpadsAsync() program.
+// The main loop only gets to look at the status every loopMicros.
+void fleetScan(int numDevices, unsigned int loopMicros)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  for (size_t i = 0; i < fleet.devices.size(); i++) fleet.devices[i].holdsBusWhileConverting = true;
+
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) memcpy(ids[i], fleet.devices[i].rom, 8);
+  printf("\n%d sensors, main loop every %uus\n", numDevices, loopMicros);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  for (int i = 0; i <= numDevices; i++) {
+    do {
+      delayMicroseconds(loopMicros);
+    } while (myTemperatureSensors.getStatus() != 0);
+    if (i < numDevices) myTemperatureSensors.readScratchpadAsync(ids[i], pads[i]);
+  }
+  double stepwise = (simNowNs - startedAt) / 1e6;
+
+  startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+  do {
+    delayMicroseconds(loopMicros);
+  } while (myTemperatureSensors.getStatus() != 0);
+  double wholeFleet = (simNowNs - startedAt) / 1e6;
+
+  startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads, true);
+  do {
+    delayMicroseconds(loopMicros);
+  } while (myTemperatureSensors.getStatus() != 0);
+  double temperaturesOnly = (simNowNs - startedAt) / 1e6;
+
+  int good = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+  }
+  printf("Step by step %.1fms, readAllScratchpadsAsync %.1fms, temperatures only %.1fms (%d of %d read correctly)\n",
+         stepwise, wholeFleet, temperaturesOnly, good, numDevices);
+  theWire.detachAll();
+}
+
+// Two scans back to back into the same scratchpad buffers, so the second overwrites the
+// first, while the main loop takes readings out of the ring every loopMicros.
+int drainScans(SimulatedSensorFleet &fleet, DeviceAddress ids[], ScratchPad pads[], int numDevices,
+               unsigned int loopMicros, int &received)
+{
+  int good = 0;
+  received = 0;
+  for (int scan = 0; scan < 2; scan++) {
+    for (int i = 0; i < numDevices; i++) fleet.devices[i].temperatureC = 20 + scan * 5 + i * 0.25;
+    myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+    bool busy = true;
+    while (busy) {
+      delayMicroseconds(loopMicros);
+      busy = (myTemperatureSensors.getStatus() & StillBusy) != 0;
+      TemperatureReading r;
+      while (myTemperatureSensors.nextReading(r)) {
+        received++;
+        if (r.status == 0 && fabs(myTemperatureSensors.getTempC(r) - fleet.devices[r.device].temperatureC) < 0.07) good++;
+      }
+    }
+  }
+  return good;
+}
+
+// The main loop's view of readings: a ring it can drain whenever it likes, instead of the
+// scratchpad buffers, which the next scan overwrites.
+void readingRing(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].holdsBusWhileConverting = true;
+  }
+  printf("\n%d sensors, scanned twice into the same buffers\n", numDevices);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  TemperatureReading readings[8];
+  int received;
+  myTemperatureSensors.setReadingRing(readings, 8);
+  int good = drainScans(fleet, ids, pads, numDevices, 20000, received);
+  printf("Ring of 8, main loop every 20ms: %d readings, %d of them right for their scan, %d dropped\n",
+         received, good, myTemperatureSensors.getReadingsDropped());
+
+  myTemperatureSensors.setReadingRing(readings, 4);
+  good = drainScans(fleet, ids, pads, numDevices, 100000, received);
+  printf("Ring of 4, main loop every 100ms: %d readings, %d of them right for their scan, %d dropped\n",
+         received, good, myTemperatureSensors.getReadingsDropped());
+
+  // Single-drop reads skip the ROM, so the ring has to tell the families apart by their scratchpads.
+  theWire.detachAll();
+  SimulatedSensorFleet loners;
+  DeviceAddress lonerIds[2] = {{0x28, 1, 2, 3, 4, 5, 6, 0}, {0x10, 1, 2, 3, 4, 5, 6, 0}};
+  good = 0;
+  for (int i = 0; i < 2; i++) {
+    loners.add(theWire, lonerIds[i]).temperatureC = 21.5;
+    myTemperatureSensors.convertAllTemperaturesAsync();
+    delay(800);
+    myTemperatureSensors.readUniqueScratchpadAsync(sPad);
+    while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    TemperatureReading r;
+    if (myTemperatureSensors.nextReading(r) && r.status == 0 && fabs(myTemperatureSensors.getTempC(r) - 21.5) < 0.07) good++;
+    theWire.detachAll();
+  }
+  printf("Single-drop reads through the ring: %d of 2 right; ring of 1 %s\n",
+         good, myTemperatureSensors.setReadingRing(readings, 1) ? "accepted" : "refused");
+
+  myTemperatureSensors.setReadingRing(NULL, 0);
+  theWire.detachAll();
+}
+
+// Set it going once, and the readings just keep coming: the main loop only looks at the
+// ring now and again.
+void continuousSampling(int numDevices, unsigned int periodMs, int seconds)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].holdsBusWhileConverting = true;
+    fleet.devices[i].temperatureAt = [i](uint64_t t) { return 20 + i + t / 1e9 * 0.1; };   // Warming by 0.1C a second
+  }
+  printf("\n%d sensors, sampled every %ums for %ds\n", numDevices, periodMs, seconds);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  TemperatureReading readings[32];
+  myTemperatureSensors.setReadingRing(readings, 32);
+  unsigned long slicesBefore = simTimer2.interruptCount;
+  myTemperatureSensors.sampleContinuouslyAsync(ids, numDevices, pads, periodMs);
+  int received = 0, good = 0;
+  unsigned long firstAt = 0, lastAt = 0;
+  for (int ms = 0; ms < seconds * 1000; ms += 250) {
+    delay(250);                     // The main loop, busy with other things.
+    TemperatureReading r;
+    while (myTemperatureSensors.nextReading(r)) {
+      if (received++ == 0) firstAt = r.at;
+      lastAt = r.at;
+      // Read within a few ms of the conversion, so it should be the temperature as at r.at, near enough.
+      if (r.status == 0 && fabs(myTemperatureSensors.getTempC(r) - fleet.devices[r.device].temperatureAt(r.at * 1000000ULL)) < 0.07) good++;
+    }
+  }
+  unsigned long interrupts = simTimer2.interruptCount - slicesBefore;
+  myTemperatureSensors.stopSampling();
+  uint64_t stoppedAt = simNowNs;
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("%d readings (%d right) over %lums, %lu interrupts, %d dropped; stopped %.1fms after asking\n",
+         received, good, lastAt - firstAt, interrupts, myTemperatureSensors.getReadingsDropped(),
+         (simNowNs - stoppedAt) / 1e6);
+  myTemperatureSensors.setReadingRing(NULL, 0);
+  theWire.detachAll();
+}
+
+// Two parts of a sketch sharing one bus, neither knowing what the other just asked for:
+// their requests queue up behind each other instead of cutting each other off.
+void sharedBus(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].holdsBusWhileConverting = true;
+  }
+  printf("\n%d sensors, requests queued back to back\n", numDevices);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  DeviceAddress table[numDevices];
+  ScratchPad one, two;
+  uint64_t startedAt = simNowNs;
+  byte tickets[6];
+  tickets[0] = myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+  tickets[1] = myTemperatureSensors.readTemperatureAsync(ids[0], one);
+  tickets[2] = myTemperatureSensors.findDevicesAsync(table, numDevices);
+  tickets[3] = myTemperatureSensors.readScratchpadAsync(ids[numDevices - 1], two);
+  tickets[4] = myTemperatureSensors.resetAsync();
+  tickets[5] = myTemperatureSensors.resetAsync();     // One more than the queue holds
+  while (myTemperatureSensors.getStatus() & StillBusy) delayMicroseconds(100);
+
+  int good = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+  }
+  printf("All done in %.1fms: %d of %d read correctly, found %d, first %.2fC, last %.2fC\n",
+         (simNowNs - startedAt) / 1e6, good, numDevices, myTemperatureSensors.getNumDevicesFound(),
+         myTemperatureSensors.getTempC(ids[0], one), myTemperatureSensors.getTempC(ids[numDevices - 1], two));
+  printf("  tickets");
+  for (int i = 0; i < 6; i++) {
+    printf(" %d:0x%02X", tickets[i], myTemperatureSensors.getTicketStatus(tickets[i]));
+  }
+  printf("\n");
+
+  // A single read while the bus is sampled continuously gets its turn between two cycles.
+  byte sampler = myTemperatureSensors.sampleContinuouslyAsync(ids, numDevices, pads, 500);
+  delay(1200);
+  startedAt = simNowNs;
+  byte single = myTemperatureSensors.readTemperatureAsync(ids[1], one);
+  while (myTemperatureSensors.getTicketStatus(single) == StillBusy) delay(1);
+  double waited = (simNowNs - startedAt) / 1e6;
+  delay(1000);
+  myTemperatureSensors.stopSampling();
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  good = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+  }
+  printf("  While sampling: a single read waited %.1fms (%s, status 0x%02X), sampler 0x%02X with %d of %d right\n",
+         waited, fabs(myTemperatureSensors.getTempC(ids[1], one) - fleet.devices[1].temperatureC) < 0.07 ? "right" : "wrong",
+         myTemperatureSensors.getTicketStatus(single), myTemperatureSensors.getTicketStatus(sampler), good, numDevices);
+
+  // Lots of requests, at all sorts of points in the cycle, then another sampling taking over
+  // from the first.  Every ticket has to finish, the first sampler's included.
+  ScratchPad alarmed[numDevices];
+  sampler = myTemperatureSensors.sampleContinuouslyAsync(ids, numDevices, pads, 500);
+  int finished = 0, asked = 0;
+  for (int i = 0; i < 5; i++) {     // Few enough that getTicketStatus() still remembers the sampler.
+    delay(97 * i % 230);
+    byte t = (i % 3 == 0) ? myTemperatureSensors.resetAsync()
+           : (i % 3 == 1) ? myTemperatureSensors.readTemperatureAsync(ids[i % numDevices], one)
+           : myTemperatureSensors.readAlarmedScratchpadsAsync(table, numDevices, alarmed);  // The deepest the stack gets.
+    asked++;
+    uint64_t giveUpAt = simNowNs + 3000000000ULL;
+    while (myTemperatureSensors.getTicketStatus(t) == StillBusy && simNowNs < giveUpAt) delay(1);
+    if (myTemperatureSensors.getTicketStatus(t) != StillBusy) finished++;
+  }
+  byte takeover = myTemperatureSensors.sampleContinuouslyAsync(ids, numDevices / 2, pads, 300);
+  uint64_t giveUpAt = simNowNs + 3000000000ULL;
+  while (myTemperatureSensors.getTicketStatus(sampler) == StillBusy && simNowNs < giveUpAt) delay(1);
+  byte firstSampler = myTemperatureSensors.getTicketStatus(sampler);
+  byte takeoverWhileRunning = myTemperatureSensors.getTicketStatus(takeover);
+  delay(700);
+  myTemperatureSensors.stopSampling();
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("  Interleaved with sampling: %d of %d requests finished, first sampler 0x%02X, the one taking over 0x%02X then 0x%02X\n",
+         finished, asked, firstSampler, takeoverWhileRunning, myTemperatureSensors.getTicketStatus(takeover));
+
+  // A convert-all in the middle of the queue: StillBusy has to stay set until the last
+  // request is done, or a loop waiting on it gives up early.
+  byte around[3];
+  around[0] = myTemperatureSensors.readTemperatureAsync(ids[0], one);
+  around[1] = myTemperatureSensors.convertAllTemperaturesAsync();
+  around[2] = myTemperatureSensors.readTemperatureAsync(ids[1], two);
+  int earlyPolls = 0;
+  while (myTemperatureSensors.getStatus() & StillBusy) {
+    delayMicroseconds(100);
+    if (!(myTemperatureSensors.getStatus() & StillBusy) && myTemperatureSensors.getTicketStatus(around[2]) == StillBusy) earlyPolls++;
+  }
+  printf("  Read, convert all, read: tickets 0x%02X 0x%02X 0x%02X, %d polls without StillBusy while a request was queued\n",
+         myTemperatureSensors.getTicketStatus(around[0]), myTemperatureSensors.getTicketStatus(around[1]),
+         myTemperatureSensors.getTicketStatus(around[2]), earlyPolls);
+
+  // And the old way, flushing everything, when that's what you want.
+  byte doomed = myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+  byte queued = myTemperatureSensors.resetAsync();
+  delay(10);
+  myTemperatureSensors.cancelAll();
+  byte after = myTemperatureSensors.resetAsync();
+  while (myTemperatureSensors.getStatus() & StillBusy) delayMicroseconds(100);
+  printf("  cancelAll: cancelled 0x%02X and 0x%02X, the next request 0x%02X\n",
+         myTemperatureSensors.getTicketStatus(doomed), myTemperatureSensors.getTicketStatus(queued),
+         myTemperatureSensors.getTicketStatus(after));
+  theWire.detachAll();
+}
+
+// Reads one sensor over and over on a noisy cable, and checks that every read
+// that came back wrong was flagged with CRCError.  Then lets the interpreter retry.
+void noisyCable(int reads, double noiseRate)
+{
+  SimulatedSensorFleet fleet;
+  SimulatedDS18B20 &d = fleet.add(theWire, device[1]);
+  d.temperatureC = 23.5;
+  d.setTemperature(d.temperatureC);
+  theWire.noiseRate = noiseRate;
+  printf("\nNoisy cable, %.1f%% of bits flipped\n", noiseRate * 100);
+
+  for (byte retries = 0; retries <= 3; retries += 3) {
+    byte retryCount = 0;
+    myTemperatureSensors.setRetries(retries, &retryCount);
+    int wrong = 0, flagged = 0, wrongButUnflagged = 0;
+    for (int i = 0; i < reads; i++) {
+      myTemperatureSensors.readScratchpadAsync(device[1], sPad);
+      while (myTemperatureSensors.getStatus() & StillBusy) delayMicroseconds(100);
+      bool isWrong = memcmp(sPad, d.scratchpad, 9) != 0;
+      bool isFlagged = (myTemperatureSensors.getStatus() & CRCError) != 0;
+      wrong += isWrong;
+      flagged += isFlagged;
+      wrongButUnflagged += isWrong && !isFlagged;
+    }
+    printf("%d retries: %d of %d reads corrupt, %d flagged CRCError, %d slipped through, %d retries used\n",
+           retries, wrong, reads, flagged, wrongButUnflagged, retryCount);
+  }
+  theWire.detachAll();
+
+  // A fleet where only some of the cable is noisy: retry counts point at the bad devices.
+  theWire.noiseRate = 0;
+  const int n = 8;
+  fleet.addRandom(theWire, n, 0x28);
+  fleet.devices[3].noiseRate = noiseRate;
+  fleet.devices[6].noiseRate = noiseRate * 2;
+  DeviceAddress ids[n];
+  ScratchPad pads[n];
+  byte retryCounts[n] = {0};
+  for (int i = 0; i < n; i++) memcpy(ids[i], fleet.devices[i + 1].rom, 8);
+  myTemperatureSensors.setRetries(5, retryCounts);
+  for (int scan = 0; scan < 10; scan++) {
+    myTemperatureSensors.readAllScratchpadsAsync(ids, n, pads);
+    while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  }
+  printf("Retries per device over 10 scans (bad cable to devices 2 and 5):");
+  for (int i = 0; i < n; i++) printf(" %d", retryCounts[i]);
+  printf("\n");
+
+  myTemperatureSensors.setRetries(0);
+  theWire.detachAll();
+}
+
+// A short to ground, or a device that has latched up: the line never comes up again.
+class StuckLow : public SimulatedSlave
+{
+  public:
+    void masterPulledLow(uint64_t /*t*/) {}
+    void masterReleased(uint64_t /*t*/, uint64_t /*lowNs*/) {}
+    bool holdsLow(uint64_t /*t*/) { return true; }
+};
+
+// A bus stuck low looks like a presence pulse, and then reads nothing but zeros, which
+// pass the CRC.  None of it may come back looking like a good reading.
+void stuckBus()
+{
+  StuckLow shorted;
+  theWire.attach(&shorted);
+  printf("\nBus stuck low\n");
+
+  memset(sPad, 0, sizeof(sPad));
+  myTemperatureSensors.readScratchpadAsync(device[1], sPad);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("  readScratchpadAsync: status=0x%02x\n", myTemperatureSensors.getStatus());
+
+  DeviceAddress id;
+  myTemperatureSensors.getUniqueDeviceIDAsync(id);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("  getUniqueDeviceIDAsync: status=0x%02x\n", myTemperatureSensors.getStatus());
+
+  DeviceAddress table[4];
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.findDevicesAsync(table, 4);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("  findDevicesAsync: found %d in %.1fms, status=0x%02x\n", myTemperatureSensors.getNumDevicesFound(),
+         (simNowNs - startedAt) / 1e6, myTemperatureSensors.getStatus());
+  theWire.detachAll();
+}
+
+// Three more buses, sharing TIMER2 with myTemperatureSensors through busScheduler.
+AsyncTemperatureReader<PortB, 0b00000001> busB0;
+AsyncTemperatureReader<PortC, 0b00000001> busC0;
+AsyncTemperatureReader<PortD, 0b00000100> busD2;
+AsyncTemperatureReader<PortC, 0b11110000> laneC;  // Four buses, PORTC bits 4-7, driven in lock step
+AsyncTemperatureReader<PortD, 0b00001000> busD3;  // Calibrated in begin()
+
+// Scans numDevices sensors all on one cable, then the same number split across four buses at once.
+void multipleBuses(int numDevices)
+{
+  const int numBuses = 4;
+  int perBus = numDevices / numBuses;
+  SimulatedWire *wires[numBuses] = { &theWire, &simPortB.wire[0], &simPortC.wire[0], &simPortD.wire[2] };
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  for (size_t i = 0; i < fleet.devices.size(); i++) fleet.devices[i].holdsBusWhileConverting = true;
+
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) memcpy(ids[i], fleet.devices[i].rom, 8);
+  printf("\n%d sensors on one bus, then %d on each of %d buses\n", numDevices, perBus, numBuses);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  double oneBus = (simNowNs - startedAt) / 1e6;
+  memset(pads, 0, sizeof(pads));
+
+  // Move each quarter of the sensors onto its own cable.
+  theWire.detachAll();
+  for (int i = 0; i < numDevices; i++) wires[i / perBus]->attach(&fleet.devices[i]);
+
+  unsigned long violationsBefore = 0;
+  for (int b = 0; b < numBuses; b++) violationsBefore += wires[b]->violations;
+  startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, perBus, pads);
+  busB0.readAllScratchpadsAsync(ids + perBus, perBus, pads + perBus);
+  busC0.readAllScratchpadsAsync(ids + 2 * perBus, perBus, pads + 2 * perBus);
+  busD2.readAllScratchpadsAsync(ids + 3 * perBus, perBus, pads + 3 * perBus);
+  while ((myTemperatureSensors.getStatus() | busB0.getStatus() | busC0.getStatus() | busD2.getStatus()) & StillBusy) delay(1);
+  double fourBuses = (simNowNs - startedAt) / 1e6;
+
+  int good = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+  }
+  unsigned long violations = 0;
+  for (int b = 0; b < numBuses; b++) violations += wires[b]->violations;
+  printf("One bus %.1fms, four buses %.1fms (%d of %d read correctly, %lu timing violations)\n", oneBus, fourBuses, good,
+         numDevices, violations - violationsBefore);
+  for (int b = 1; b < numBuses; b++) wires[b]->detachAll();
+  theWire.detachAll();
+}
+
+// Every reader busy at once: five single buses and the four lanes of laneC, perBus sensors
+// on each.  That's as crowded as the ISR gets, and a write-0 slot or a reset's presence
+// pulse that waits behind the others for too long is a device that resets, or isn't seen.
+void sixReaders(int perBus)
+{
+  const int numWires = 9;
+  SimulatedWire *wires[numWires] = { &theWire, &simPortB.wire[0], &simPortC.wire[0], &simPortD.wire[2], &simPortD.wire[3],
+                                     &simPortC.wire[4], &simPortC.wire[5], &simPortC.wire[6], &simPortC.wire[7] };
+  const int numDevices = perBus * numWires;
+  SimulatedSensorFleet fleet;
+  for (int w = 0; w < numWires; w++) {
+    fleet.addRandom(*wires[w], perBus, 0x28, 95000000ULL, 95000000ULL);
+  }
+  unsigned long violationsBefore = 0;
+  for (int w = 0; w < numWires; w++) violationsBefore += wires[w]->violations;
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  DeviceAddress laneIds[4 * perBus];
+  ScratchPad lanePads[4 * perBus];
+  for (int i = 0; i < numDevices; i++) memcpy(ids[i], fleet.devices[i].rom, 8);
+  for (int i = 0; i < 4 * perBus; i++) {          // Device d of laneC's list is on lane d % 4.
+    memcpy(laneIds[i], ids[(5 + i % 4) * perBus + i / 4], 8);
+  }
+  printf("\nAll six readers busy: %d sensors on each of %d buses\n", perBus, numWires);
+
+  uint64_t longestBefore = simTimer2.longestIsrNs;
+  simTimer2.longestIsrNs = 0;
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, perBus, pads);
+  busB0.readAllScratchpadsAsync(ids + perBus, perBus, pads + perBus);
+  busC0.readAllScratchpadsAsync(ids + 2 * perBus, perBus, pads + 2 * perBus);
+  busD2.readAllScratchpadsAsync(ids + 3 * perBus, perBus, pads + 3 * perBus);
+  busD3.readAllScratchpadsAsync(ids + 4 * perBus, perBus, pads + 4 * perBus);
+  laneC.readAllScratchpadsAsync(laneIds, 4 * perBus, lanePads);
+  while ((myTemperatureSensors.getStatus() | busB0.getStatus() | busC0.getStatus() | busD2.getStatus() |
+          busD3.getStatus() | laneC.getStatus()) & StillBusy) delay(1);
+  double took = (simNowNs - startedAt) / 1e6;
+
+  int good = 0;
+  for (int i = 0; i < 5 * perBus; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+  }
+  for (int i = 0; i < 4 * perBus; i++) {
+    if (fabs(myTemperatureSensors.getTempC(laneIds[i], lanePads[i]) - fleet.find(laneIds[i])->temperatureC) < 0.07) good++;
+  }
+  unsigned long violations = 0;
+  for (int w = 0; w < numWires; w++) violations += wires[w]->violations;
+  violations -= violationsBefore;
+  printf("%.1fms, longest ISR %.1fus: %d of %d read correctly, %lu timing violations\n",
+         took, simTimer2.longestIsrNs / 1000.0, good, numDevices, violations);
+  if (longestBefore > simTimer2.longestIsrNs) simTimer2.longestIsrNs = longestBefore;
+  for (int w = 0; w < numWires; w++) wires[w]->detachAll();
+}
+
+// A build whose ISR is slow to get going (an older compiler, say, or somebody else's interrupt
+// in the way).  The scheduler asks for the interrupt early to make up for it, so the slots
+// should come out right as they are, and calibrating should find next to nothing to put right.
+void calibration(int numDevices)
+{
+  SimulatedWire &wire = simPortD.wire[3];
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(wire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].holdsBusWhileConverting = true;
+  }
+  printf("\n%d sensors on PORTD bit 3, calibrated at begin(): overhead %dus, reset %d tics\n", numDevices,
+         busD3.getOverheadMicros(), busD3.getSlotTics(Slot480));
+  uint64_t normalOverheadNs = simIsrOverheadNs;
+  simIsrOverheadNs = 12000;
+
+  for (int pass = 0; pass < 2; pass++) {
+    unsigned long violationsBefore = wire.violations;
+    memset(pads, 0, sizeof(pads));
+    busD3.readAllScratchpadsAsync(ids, numDevices, pads);
+    while (busD3.getStatus() & StillBusy) delay(1);
+    int good = 0;
+    for (int i = 0; i < numDevices; i++) {
+      if (fabs(busD3.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+    }
+    printf("  ISR entry really 12us, %s: %d of %d read correctly, %lu timing violations\n",
+           pass == 0 ? "as calibrated before" : "calibrated again", good, numDevices, wire.violations - violationsBefore);
+    if (pass == 0) {
+      busD3.calibrateTimingsAsync();
+      while (busD3.getStatus() & StillBusy) delay(1);
+      printf("  Calibrated again: overhead %dus, reset %d tics\n", busD3.getOverheadMicros(), busD3.getSlotTics(Slot480));
+    }
+  }
+  simIsrOverheadNs = normalOverheadNs;
+
+  // Another reader with work to do would spoil the measurement, so calibration leaves well alone.
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  byte ticket = busD3.calibrateTimingsAsync();
+  while (busD3.getStatus() & StillBusy) delay(1);
+  printf("  Calibrated while PORTB bit 4 converts: ticket 0x%02X, status 0x%02x, reset %d tics\n",
+         busD3.getTicketStatus(ticket), busD3.getStatus(), busD3.getSlotTics(Slot480));
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+
+  // And begin(true), which waits for its calibration, with two other buses busy.
+  SimulatedSensorFleet others;
+  others.add(theWire, device[1]).holdsBusWhileConverting = true;
+  others.add(simPortB.wire[0], device[0]).holdsBusWhileConverting = true;
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  busB0.convertAllTemperaturesAsync();
+  uint64_t startedAt = simNowNs;
+  busD3.begin(true);
+  printf("  begin(true) while PORTB bits 0 and 4 convert: back after %.1fms, status 0x%02x\n",
+         (simNowNs - startedAt) / 1e6, busD3.getStatus());
+  while ((myTemperatureSensors.getStatus() | busB0.getStatus()) & StillBusy) delay(1);
+  theWire.detachAll();
+  simPortB.wire[0].detachAll();
+  wire.detachAll();
+}
+
+// The same 10 sensors read with 1, 2 and 4 bit slots to a timeslice: fewer interrupts,
+// longer timeslices.  And with 4 again while another bus is busy, which gets it 1.
+void slotsPerSlice(int numDevices)
+{
+  SimulatedWire &wire = simPortD.wire[3];
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(wire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].holdsBusWhileConverting = true;
+  }
+  printf("\n%d sensors on PORTD bit 3, several bit slots to a timeslice\n", numDevices);
+
+  SimulatedSensorFleet other;
+  const byte ks[] = { 1, 2, 4, 4 };
+  for (int pass = 0; pass < 4; pass++) {
+    byte k = ks[pass];
+    bool shared = pass == 3;
+    if (shared) {                   // PORTB bit 4 has work too: a conversion to poll for.
+      other.add(theWire, device[0]).holdsBusWhileConverting = true;
+      myTemperatureSensors.convertAllTemperaturesAsync();
+    }
+    busD3.setSlotsPerSlice(k);
+    unsigned long violationsBefore = wire.violations;
+    unsigned long slicesBefore = simTimer2.interruptCount;
+    uint64_t longestBefore = simTimer2.longestIsrNs;
+    simTimer2.longestIsrNs = 0;
+    uint64_t startedAt = simNowNs;
+    memset(pads, 0, sizeof(pads));
+    busD3.readAllScratchpadsAsync(ids, numDevices, pads);
+    while (busD3.getStatus() & StillBusy) delay(1);
+    int good = 0;
+    for (int i = 0; i < numDevices; i++) {
+      if (fabs(busD3.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+    }
+    printf("  %d per timeslice%s: %.1fms, %lu interrupts, longest ISR %.1fus (%d of %d read correctly, %lu timing violations)\n",
+           k, shared ? ", PORTB bit 4 busy" : "", (simNowNs - startedAt) / 1e6, simTimer2.interruptCount - slicesBefore, simTimer2.longestIsrNs / 1000.0,
+           good, numDevices, wire.violations - violationsBefore);
+    if (longestBefore > simTimer2.longestIsrNs) simTimer2.longestIsrNs = longestBefore;
+    if (shared) {
+      while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+      theWire.detachAll();
+    }
+  }
+  busD3.setSlotsPerSlice(1);
+  wire.detachAll();
+}
+
+// Externally powered sensors (they don't hold the bus while converting) at 12 bits, then 9.
+void resolutions(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) memcpy(ids[i], fleet.devices[i].rom, 8);
+  printf("\n%d externally powered sensors\n", numDevices);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  double ms[2];
+  int good[2] = { 0, 0 };
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      myTemperatureSensors.writeAllScratchpadsAsync(30, -10, 9);
+      while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    }
+    uint64_t startedAt = simNowNs;
+    myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+    while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    ms[pass] = (simNowNs - startedAt) / 1e6;
+    for (int i = 0; i < numDevices; i++) {
+      double tolerance = pass == 0 ? 0.07 : 0.5;
+      if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < tolerance) good[pass]++;
+    }
+  }
+  printf("Convert and read all: 12 bits %.1fms (%d correct), 9 bits %.1fms (%d correct to 0.5C)\n",
+         ms[0], good[0], ms[1], good[1]);
+
+  // One device to 10 bits, saved to EEPROM, and still so after a power cycle.
+  myTemperatureSensors.writeScratchpadAsync(ids[0], 40, 0, 10, true);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  fleet.devices[0].powerOn();
+  printf("Device 0 after power cycle: TH %d, TL %d, %d bits, status=0x%02x\n", fleet.devices[0].scratchpad[2],
+         fleet.devices[0].scratchpad[3], fleet.devices[0].resolution(), myTemperatureSensors.getStatus());
+
+  myTemperatureSensors.writeAllScratchpadsAsync(75, 70, 12);   // Back to the power-on settings for whoever's next.
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  theWire.detachAll();
+}
+
+// Externally powered sensors that finish well inside the datasheet's 750ms: waiting it out,
+// against asking them with read slots.
+void conversionPolling(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 300000000ULL, 600000000ULL);
+  uint64_t slowest = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fleet.devices[i].conversionNs > slowest) slowest = fleet.devices[i].conversionNs;
+  }
+  printf("\n%d externally powered sensors, the slowest converts in %.1fms\n", numDevices, slowest / 1e6);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  // The first polled conversion has no history to go on; after that we sleep through most of it.
+  const unsigned int intervals[] = { 0, Micros1000, Micros1000, Micros1000, Micros1000 / 10 };
+  for (int i = 0; i < 5; i++) {
+    myTemperatureSensors.setPollInterval(intervals[i]);
+    unsigned int expected = myTemperatureSensors.getExpectedConversionMillis();
+    unsigned long slicesBefore = simTimer2.interruptCount;
+    uint64_t startedAt = simNowNs;
+    myTemperatureSensors.convertAllTemperaturesAsync();   // Perhaps queued behind the last one's tail end.
+    while (myTemperatureSensors.getStatus() & (StillBusy | DevicesAreBusy)) delayMicroseconds(20);
+    printf("  poll interval %3d tics, expecting %3ums: conversion over after %.1fms, %lu interrupts\n", intervals[i],
+           expected, (simNowNs - startedAt) / 1e6, simTimer2.interruptCount - slicesBefore);
+  }
+
+  // Polling turned off halfway through a conversion: no more read slots, just the datasheet time.
+  myTemperatureSensors.setPollInterval(Micros1000);
+  myTemperatureSensors.setExpectedConversionMillis(0);
+  unsigned long slicesBefore = simTimer2.interruptCount;
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.convertAllTemperaturesAsync();
+  delay(100);
+  myTemperatureSensors.setPollInterval(0);
+  while (myTemperatureSensors.getStatus() & (StillBusy | DevicesAreBusy)) delayMicroseconds(20);
+  printf("  polling turned off after 100ms: conversion over after %.1fms, %lu interrupts\n",
+         (simNowNs - startedAt) / 1e6, simTimer2.interruptCount - slicesBefore);
+
+  // Both ends of the range, and past the top of it: 65535 is NothingToDo, and 40000 would
+  // look overdue to the scheduler, so both are taken as longestHoldoff.
+  const unsigned int extremes[] = { 1, longestHoldoff, 40000, 65535 };
+  for (int i = 0; i < 4; i++) {
+    myTemperatureSensors.setPollInterval(extremes[i]);
+    myTemperatureSensors.setExpectedConversionMillis(0);
+    uint64_t longestBefore = simTimer2.longestIsrNs;
+    simTimer2.longestIsrNs = 0;
+    startedAt = simNowNs;
+    myTemperatureSensors.convertAllTemperaturesAsync();
+    while ((myTemperatureSensors.getStatus() & (StillBusy | DevicesAreBusy)) && simNowNs - startedAt < 2000000000ULL) {
+      delayMicroseconds(20);
+    }
+    printf("  poll interval %5u tics, taken as %5u: conversion over after %.1fms, status 0x%02x, longest ISR %.1fus\n",
+           extremes[i], myTemperatureSensors.getPollInterval(), (simNowNs - startedAt) / 1e6,
+           myTemperatureSensors.getStatus(), simTimer2.longestIsrNs / 1000.0);
+    if (longestBefore > simTimer2.longestIsrNs) simTimer2.longestIsrNs = longestBefore;
+  }
+  myTemperatureSensors.setPollInterval(Micros1000);
+  theWire.detachAll();
+}
+
+// Genuine DS18B20s and cheap 0x10 clones, all converting at their own speeds: profile each
+// of them, then let the profile plan the conversion wait of a whole-fleet read.
+void conversionProfile(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices / 2, 0x28, 450000000ULL, 600000000ULL);
+  fleet.addRandom(theWire, numDevices - numDevices / 2, 0x10, 150000000ULL, 700000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  unsigned int profile[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    profile[i] = 0;
+  }
+  printf("\n%d sensors, half of them 0x10 clones, converting in 150 to 700ms\n", numDevices);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  myTemperatureSensors.setConversionProfile(profile);
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.profileConversionsAsync(ids, numDevices);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  int worst = 0;
+  for (int i = 0; i < numDevices; i++) {
+    int error = abs((int) profile[i] - (int) (fleet.devices[i].conversionNs / 1000000));
+    if (error > worst) worst = error;
+  }
+  printf("Profiled in %.1fms, each device within %dms (device 0: %ums, device %d: %ums)\n", (simNowNs - startedAt) / 1e6,
+         worst, profile[0], numDevices - 1, profile[numDevices - 1]);
+
+  const char *labels[] = { "without a profile", "with the profile" };
+  for (int pass = 0; pass < 2; pass++) {
+    myTemperatureSensors.setConversionProfile(pass == 0 ? NULL : profile);
+    myTemperatureSensors.setExpectedConversionMillis(0);
+    unsigned long slicesBefore = simTimer2.interruptCount;
+    startedAt = simNowNs;
+    myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+    while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    int good = 0;
+    for (int i = 0; i < numDevices; i++) {
+      if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+    }
+    printf("  First read of all %s: %.1fms, %lu interrupts (%d of %d read correctly)\n", labels[pass],
+           (simNowNs - startedAt) / 1e6, simTimer2.interruptCount - slicesBefore, good, numDevices);
+  }
+  myTemperatureSensors.setConversionProfile(NULL);
+  theWire.detachAll();
+}
+
+// Two-wire probes on the same bus as powered ones: they need a strong pull-up for each
+// conversion, and can't be polled.
+void parasiticPower(int numDevices, int numParasitic)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 500000000ULL, 700000000ULL);
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    fleet.devices[i].parasitic = i < numParasitic;
+  }
+  printf("\n%d sensors, %d of them parasitically powered\n", numDevices, numParasitic);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  for (int pass = 0; pass < 3; pass++) {
+    if (pass == 1) {
+      myTemperatureSensors.readPowerSupplyAsync();
+      while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+      printf("  readPowerSupplyAsync: parasite powered %d, status=0x%02x\n", myTemperatureSensors.isParasitePowered(),
+             myTemperatureSensors.getStatus());
+    }
+    if (pass == 2) {
+      myTemperatureSensors.writeAllScratchpadsAsync(75, 70, 9, true);
+      while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    }
+    unsigned long brownOutsBefore = 0;
+    for (int i = 0; i < numDevices; i++) brownOutsBefore += fleet.devices[i].brownOuts;
+    uint64_t startedAt = simNowNs;
+    myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+    while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+    int good = 0;
+    unsigned long brownOuts = 0;
+    for (int i = 0; i < numDevices; i++) {
+      double tolerance = pass == 2 ? 0.5 : 0.07;
+      if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < tolerance) good++;
+      brownOuts += fleet.devices[i].brownOuts;
+    }
+    printf("  Convert and read all at %d bits: %.1fms (%d of %d read correctly, %lu browned out)\n", pass == 2 ? 9 : 12,
+           (simNowNs - startedAt) / 1e6, good, numDevices, brownOuts - brownOutsBefore);
+  }
+
+  myTemperatureSensors.writeAllScratchpadsAsync(75, 70, 12, true);   // Back to the power-on settings for whoever's next.
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  theWire.detachAll();
+  myTemperatureSensors.readPowerSupplyAsync();   // Nobody there now, so nobody parasitic.
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+}
+
+// An over-temperature guard: only the sensors at 30C or more need reading.
+void alarmSearch(int numDevices)
+{
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  int expected = 0;
+  for (int i = 0; i < numDevices; i++) {
+    SimulatedDS18B20 &d = fleet.devices[i];
+    d.holdsBusWhileConverting = true;
+    d.scratchpad[2] = 30;            // TH
+    d.scratchpad[3] = (byte) -10;    // TL
+    if (d.temperatureC >= 30) expected++;
+  }
+
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  for (int i = 0; i < numDevices; i++) memcpy(ids[i], fleet.devices[i].rom, 8);
+  printf("\n%d sensors, TH 30C, %d of them in alarm\n", numDevices, expected);
+  myTemperatureSensors.setExpectedConversionMillis(0);   // Different devices: learn how quick they are afresh.
+
+  uint64_t startedAt = simNowNs;
+  myTemperatureSensors.readAllScratchpadsAsync(ids, numDevices, pads);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  double all = (simNowNs - startedAt) / 1e6;
+
+  DeviceAddress alarmed[numDevices];
+  startedAt = simNowNs;
+  myTemperatureSensors.readAlarmedScratchpadsAsync(alarmed, numDevices, pads);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  double onlyAlarmed = (simNowNs - startedAt) / 1e6;
+
+  int numFound = myTemperatureSensors.getNumDevicesFound();
+  int good = 0;
+  for (int i = 0; i < numFound; i++) {
+    SimulatedDS18B20 *d = fleet.find(alarmed[i]);
+    if (d && d->temperatureC >= 30 && fabs(myTemperatureSensors.getTempC(alarmed[i], pads[i]) - d->temperatureC) < 0.07) good++;
+  }
+  printf("Read all %.1fms, alarm search and read %.1fms (found %d, %d read correctly, status=0x%02x)\n",
+         all, onlyAlarmed, numFound, good, myTemperatureSensors.getStatus());
+
+  // With everybody back under TH, the alarm search finds nobody, and that's no error.
+  for (int i = 0; i < numDevices; i++) fleet.devices[i].temperatureC = 20;
+  myTemperatureSensors.readAlarmedScratchpadsAsync(alarmed, numDevices, pads);
+  while (myTemperatureSensors.getStatus() & StillBusy) delay(1);
+  printf("All cool: found %d, status=0x%02x\n", myTemperatureSensors.getNumDevicesFound(), myTemperatureSensors.getStatus());
+  theWire.detachAll();
+}
+
+// The same 40 sensors spread over four lanes of one multi-lane reader: device d on lane d % 4.
+void parallelLanes(int numDevices)
+{
+  const int numLanes = 4;
+  SimulatedSensorFleet fleet;
+  fleet.addRandom(theWire, numDevices, 0x28, 95000000ULL, 95000000ULL);
+  theWire.detachAll();
+  for (int i = 0; i < numDevices; i++) {
+    fleet.devices[i].holdsBusWhileConverting = true;
+    simPortC.wire[4 + i % numLanes].attach(&fleet.devices[i]);
+  }
+
+  DeviceAddress ids[numDevices];
+  ScratchPad pads[numDevices];
+  byte retries[numDevices];
+  for (int i = 0; i < numDevices; i++) {
+    memcpy(ids[i], fleet.devices[i].rom, 8);
+    retries[i] = 0;
+  }
+  printf("\n%d sensors on %d lanes of PORTC\n", numDevices, numLanes);
+
+  laneC.setRetries(3, retries);
+  uint64_t startedAt = simNowNs;
+  laneC.readAllScratchpadsAsync(ids, numDevices, pads);
+  while (laneC.getStatus() & StillBusy) delay(1);
+  double lanes = (simNowNs - startedAt) / 1e6;
+
+  int good = 0, retried = 0;
+  for (int i = 0; i < numDevices; i++) {
+    if (fabs(myTemperatureSensors.getTempC(ids[i], pads[i]) - fleet.devices[i].temperatureC) < 0.07) good++;
+    retried += retries[i];
+  }
+  printf("Four lanes %.1fms (%d of %d read correctly, %d retries, status %02x)\n", lanes, good, numDevices,
+         retried, laneC.getStatus());
+  for (int l = 0; l < numLanes; l++) simPortC.wire[4 + l].detachAll();
+}
+
+int main()
+{
+  myTemperatureSensors.begin();
+  busB0.begin();
+  busC0.begin();
+  busD2.begin();
+  laneC.begin();
+  busD3.begin(true);
+  delay(2);
+
+  transactions();
+  discovery(200);
+  fleetScan(20, 5000);
+  readingRing(20);
+  continuousSampling(10, 1000, 5);
+  sharedBus(10);
+  noisyCable(200, 0.005);
+  stuckBus();
+  resolutions(20);
+  conversionPolling(20);
+  conversionProfile(20);
+  parasiticPower(10, 4);
+  alarmSearch(40);
+  multipleBuses(40);
+  parallelLanes(40);
+  calibration(10);
+  slotsPerSlice(10);
+  sixReaders(10);
+
+  unsigned long slicesBefore = simTimer2.interruptCount;
+  delay(1000);
+  printf("\nAll six readers idle for a second: %lu interrupts\n", simTimer2.interruptCount - slicesBefore);
+
+  printf("\nLongest ISR %.1fus, stack high tide %d\n", simTimer2.longestIsrNs / 1000.0,
+         myTemperatureSensors.stackHighTide);
+  theWire.report("PORTB bit 4");
+  simPortB.wire[0].report("PORTB bit 0");
+  simPortC.wire[0].report("PORTC bit 0");
+  simPortD.wire[2].report("PORTD bit 2");
+  for (int l = 4; l < 8; l++) {
+    char name[16];
+    snprintf(name, sizeof(name), "PORTC bit %d", l);
+    simPortC.wire[l].report(name);
+  }
+  return 0;
+}